@@ -0,0 +1,2730 @@
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "db.h"
+
+#define size_of_attribute(Struct, Attribute) sizeof(((Struct*)0)->Attribute)
+#define BACKUP_BATCH_PAGES 64
+#define REPLICA_BATCH_RECORDS 64
+#define REPLICA_POLL_US 10000
+#define EXPORT_GROUP_ROWS 8192
+#define HASH_INDEX_BITS 12
+#define HASH_INDEX_SLOTS (1 << HASH_INDEX_BITS)
+#define HASH_INDEX_PROMOTE_LOOKUPS 2
+#define HASH_INDEX_MAX_LOOKUPS 16
+#define EXPORT_TEXT_BUFFER (1 << 20)
+#define KEY_FILTER_BITS_PER_KEY 10
+#define KEY_FILTER_HASHES 7
+#define INVALID_PAGE_NUM UINT32_MAX
+#define MEMTABLE_MAX_HEIGHT 16
+
+typedef struct pageVersion
+{
+	uint32_t epoch; // the page was overwritten during this epoch, snapshots taken before it read this copy
+	void * data;
+	struct pageVersion * next;
+}pageVersion;
+
+typedef struct
+{
+	// where a compressed page lives in the db file, pages are rewritten in place while they fit
+	uint64_t offset;
+	uint32_t length; // bytes stored, 0 when the page was never written and page size when stored uncompressed
+	uint32_t capacity;
+}pageExtent;
+
+typedef struct
+{
+	int file_descriptor;
+	uint64_t file_length;	
+	uint32_t num_pages;
+	// compressed files keep a map from page number to extent in the header instead of fixed page offsets
+	bool compressed;
+	pageExtent page_map[TABLE_MAX_PAGES];
+	pageExtent free_extents[TABLE_MAX_PAGES]; // space left by pages that moved, sorted by offset, length unused
+	uint32_t num_free_extents;
+	uint64_t file_end; // end of the last extent, pages that fit no free extent are appended here
+	// layout derived from the page size recorded in the file header
+	uint32_t page_size;
+	uint32_t leaf_node_max_cells;
+	uint32_t leaf_node_right_split_count;
+	uint32_t leaf_node_left_split_count;
+	uint32_t internal_node_max_cells;
+	void * pages[TABLE_MAX_PAGES];
+	/*
+		copy-on-write state for snapshots, writes happen in the current epoch and the first write to a page
+		after a snapshot was taken keeps the old contents of the page, oldest version first
+	*/
+	uint32_t epoch;
+	uint32_t num_snapshots;
+	uint32_t latest_snapshot_epoch;
+	uint32_t latest_snapshot_num_pages;
+	uint32_t page_saved_epoch[TABLE_MAX_PAGES];
+	pageVersion * page_versions[TABLE_MAX_PAGES];
+	uint32_t page_write_count[TABLE_MAX_PAGES]; // bumped whenever a page is fetched for writing
+	// held while the cache, the page versions or the snapshot list change, a backup reads pages from its own thread
+	pthread_mutex_t lock;
+	statementTrace * trace; // NULL when tracing is off
+	pthread_t trace_thread; // the thread the trace counts for
+	/*
+		errno of the first read or write that failed, EIO for a corrupt page; pages that could not be read
+		are served as failed_page, an empty leaf
+	*/
+	int error;
+	void * failed_page;
+}pager;
+
+typedef struct snapshot snapshot;
+typedef struct replica replica;
+
+typedef struct
+{
+	row r;
+	uint32_t next[MEMTABLE_MAX_HEIGHT]; // arena index of the next node on each level, 0 past the last
+}memtableNode;
+
+typedef struct
+{
+	// skiplist of the rows waiting to be merged into the tree, its nodes live in one arena of threshold+1 nodes
+	memtableNode * nodes;
+	uint32_t num_rows;
+	uint32_t threshold;
+	uint32_t height; // levels in use
+	uint32_t random_state;
+	// bloom filter over the ids in the tree
+	uint8_t * key_filter;
+	uint32_t key_filter_bits;
+}memtable;
+
+typedef struct
+{
+	/*
+		adaptive hash index slot, lookups counts the lookups of id less those of other ids that map to the slot,
+		the cell is only trusted while its page was not written since
+	*/
+	uint32_t id;
+	uint32_t lookups;
+	uint32_t page_num; // INVALID_PAGE_NUM until the id is looked up often enough
+	uint32_t cell_num;
+	uint32_t page_write_count;
+}hashIndexEntry;
+
+struct table
+{
+	uint32_t root_page_num;
+	pager * p;	
+	snapshot * snapshots; // open snapshots
+	backup * running_backup;
+	memtable * buffer; // NULL when inserts go straight to the tree
+	hashIndexEntry * hash_index; // maps hot ids straight to their leaf cell for db_get
+	// replication log records contained in the table, kept in the file header
+	uint64_t lsn;
+	int replication_log; // -1 unless inserts are appended to a replication log
+	replica * source; // set on a read-only replica following a log
+	// held for the length of a write, snapshots are only taken between writes
+	pthread_mutex_t write_lock;
+};
+
+struct snapshot
+{
+	table * t;
+	uint32_t epoch;
+	uint32_t root_page_num;
+	uint32_t num_pages;
+	snapshot * next;
+};
+
+struct backup
+{
+	snapshot * s;
+	char * path;
+	int file_descriptor;
+	pthread_t thread;
+	bool done;
+	bool failed;
+	uint32_t pages_copied;
+};
+
+struct replica
+{
+	table * t;
+	char * log_path;
+	int file_descriptor;
+	pthread_t thread;
+	pthread_mutex_t lock; // held while a batch of records is applied, db_get readers hold it around the lookup
+	bool stopping;
+};
+
+typedef struct
+{
+	table * t;	
+	snapshot * s; // NULL when reading the live tree
+	uint32_t page_num;
+	uint32_t cell_num;
+	bool end_of_table; // indicates the position one past the last element
+}cursor;
+
+typedef enum
+{
+	NODE_INTERNAL,
+	NODE_LEAF
+}nodeType;
+
+struct tableCursor
+{
+	// scans a snapshot together with a copy of the rows that were in the memtable when it was opened
+	snapshot * s;
+	cursor * c;
+	row * buffered;
+	uint32_t num_buffered;
+	uint32_t next_buffered;
+	bool reverse; // walk from the highest id down
+};
+
+// entry layout
+static const uint32_t ID_SIZE = size_of_attribute(row, id);
+static const uint32_t USERNAME_SIZE = size_of_attribute(row, username);
+static const uint32_t EMAIL_SIZE = size_of_attribute(row, email);
+static const uint32_t ID_OFFSET = 0;
+static const uint32_t USERNAME_OFFSET = ID_OFFSET+ID_SIZE;
+static const uint32_t EMAIL_OFFSET = USERNAME_OFFSET+USERNAME_SIZE;
+// page layout
+static const uint32_t ROW_SIZE = ID_SIZE+USERNAME_SIZE+EMAIL_SIZE;
+// const uint32_t ROWS_PER_PAGE = PAGE_SIZE/ROW_SIZE;
+// const uint32_t TABLE_MAX_ROWS = ROWS_PER_PAGE * TABLE_MAX_PAGES;
+// file header layout, page 0 of the file holds the header and the tree starts at page 1
+static const uint32_t HEADER_MAGIC_SIZE = sizeof(uint32_t);
+static const uint32_t HEADER_MAGIC_OFFSET = 0;
+static const uint32_t HEADER_VERSION_SIZE = sizeof(uint32_t);
+static const uint32_t HEADER_VERSION_OFFSET = HEADER_MAGIC_OFFSET + HEADER_MAGIC_SIZE;
+static const uint32_t HEADER_PAGE_SIZE_SIZE = sizeof(uint32_t);
+static const uint32_t HEADER_PAGE_SIZE_OFFSET = HEADER_VERSION_OFFSET + HEADER_VERSION_SIZE;
+static const uint32_t HEADER_ROOT_PAGE_SIZE = sizeof(uint32_t);
+static const uint32_t HEADER_ROOT_PAGE_OFFSET = HEADER_PAGE_SIZE_OFFSET + HEADER_PAGE_SIZE_SIZE;
+static const uint32_t HEADER_NUM_PAGES_SIZE = sizeof(uint32_t);
+static const uint32_t HEADER_NUM_PAGES_OFFSET = HEADER_ROOT_PAGE_OFFSET + HEADER_ROOT_PAGE_SIZE;
+static const uint32_t HEADER_NUM_HOT_PAGES_SIZE = sizeof(uint32_t);
+static const uint32_t HEADER_NUM_HOT_PAGES_OFFSET = HEADER_NUM_PAGES_OFFSET + HEADER_NUM_PAGES_SIZE;
+// number of replication log records contained in the file
+static const uint32_t HEADER_LSN_SIZE = sizeof(uint64_t);
+static const uint32_t HEADER_LSN_OFFSET = HEADER_NUM_HOT_PAGES_OFFSET + HEADER_NUM_HOT_PAGES_SIZE;
+static const uint32_t HEADER_SIZE = HEADER_MAGIC_SIZE + HEADER_VERSION_SIZE + HEADER_PAGE_SIZE_SIZE + HEADER_ROOT_PAGE_SIZE + HEADER_NUM_PAGES_SIZE + HEADER_NUM_HOT_PAGES_SIZE + HEADER_LSN_SIZE;
+// the num_hot_pages page numbers that were cached at close follow the fixed header fields
+static const uint32_t HEADER_HOT_PAGE_SIZE = sizeof(uint32_t);
+static const uint32_t HEADER_HOT_PAGES_OFFSET = HEADER_SIZE;
+static const uint32_t HEADER_PAGE_NUM = 0;
+static const uint32_t DB_FILE_MAGIC = 0x31434244; // "DBC1"
+static const uint32_t DB_FILE_VERSION = 1;
+static const uint32_t DB_FILE_VERSION_COMPRESSED = 2;
+// compressed files then map each of their num_pages pages to its extent, see header_page_map_offset
+static const uint32_t PAGE_MAP_OFFSET_SIZE = sizeof(uint64_t);
+static const uint32_t PAGE_MAP_LENGTH_SIZE = sizeof(uint32_t);
+static const uint32_t PAGE_MAP_CAPACITY_SIZE = sizeof(uint32_t);
+static const uint32_t PAGE_MAP_ENTRY_SIZE = PAGE_MAP_OFFSET_SIZE + PAGE_MAP_LENGTH_SIZE + PAGE_MAP_CAPACITY_SIZE;
+// replication log layout, a small header and then fixed size records numbered from 1
+static const uint32_t LOG_MAGIC = 0x314C4244; // "DBL1"
+static const uint32_t LOG_MAGIC_SIZE = sizeof(uint32_t);
+static const uint32_t LOG_RECORD_SIZE_SIZE = sizeof(uint32_t);
+static const uint32_t LOG_HEADER_SIZE = LOG_MAGIC_SIZE + LOG_RECORD_SIZE_SIZE;
+static const uint32_t LOG_RECORD_LSN_OFFSET = 0;
+static const uint32_t LOG_RECORD_TIME_OFFSET = LOG_RECORD_LSN_OFFSET + sizeof(uint64_t);
+static const uint32_t LOG_RECORD_ROW_OFFSET = LOG_RECORD_TIME_OFFSET + sizeof(uint64_t);
+/*
+	columnar export layout, a header and then row groups of up to EXPORT_GROUP_ROWS rows; a group holds its row count
+	and the byte sizes of the two string columns, then the id column, then for each string column the n+1 offsets
+	of its values followed by their bytes without padding
+*/
+static const uint32_t EXPORT_MAGIC = 0x31584244; // "DBX1"
+static const uint32_t EXPORT_MAGIC_OFFSET = 0;
+static const uint32_t EXPORT_NUM_ROWS_OFFSET = EXPORT_MAGIC_OFFSET + sizeof(uint32_t);
+static const uint32_t EXPORT_NUM_GROUPS_OFFSET = EXPORT_NUM_ROWS_OFFSET + sizeof(uint64_t);
+static const uint32_t EXPORT_HEADER_SIZE = EXPORT_NUM_GROUPS_OFFSET + sizeof(uint32_t);
+// extents are rounded up so a page that compresses slightly worse after a write still fits in place
+static const uint32_t PAGE_EXTENT_ALIGN = 256;
+// common node header layout
+static const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
+static const uint32_t NODE_TYPE_OFFSET = 0;
+static const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
+static const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+static const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
+static const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
+static const uint8_t COMMON_NODE_HEADER_SIZE = NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+// leaf header layout
+static const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
+static const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE;
+// leaf body layout
+static const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_KEY_OFFSET = 0;
+static const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
+static const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
+static const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+// space for cells, max cells and split counts depend on the page size, see set_page_layout
+// internal node header layout
+static const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
+static const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+// internal node body layout
+static const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+// max internal node cells depend on the page size too
+
+static bool is_valid_page_size(uint32_t page_size)
+{
+	// a power of two between the min and max page size
+	if(page_size < MIN_PAGE_SIZE || page_size > MAX_PAGE_SIZE) return false;
+	return (page_size & (page_size-1)) == 0;
+}
+
+static void set_page_layout(pager * p, uint32_t page_size)
+{
+	p->page_size = page_size;
+	p->leaf_node_max_cells = (page_size - LEAF_NODE_HEADER_SIZE) / LEAF_NODE_CELL_SIZE;
+	p->leaf_node_right_split_count = (p->leaf_node_max_cells+1)/2;
+	p->leaf_node_left_split_count = (p->leaf_node_max_cells+1)-p->leaf_node_right_split_count;
+	p->internal_node_max_cells = (page_size - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+}
+
+void db_print_constants(table * t)
+{
+	pager * p = t->p;
+	printf("ROW_SIZE: %d\n", ROW_SIZE);
+	printf("PAGE_SIZE: %d\n", p->page_size);
+	printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
+	printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
+	printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
+	printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", p->page_size - LEAF_NODE_HEADER_SIZE);
+	printf("LEAF_NODE_MAX_CELLS: %d\n", p->leaf_node_max_cells);
+	printf("INTERNAL_NODE_MAX_CELLS: %d\n", p->internal_node_max_cells);
+}
+
+static uint32_t * leaf_node_next_leaf(void * node)
+{
+	return node + LEAF_NODE_NEXT_LEAF_OFFSET;
+}
+
+static uint32_t get_unused_page_num(pager * p)
+{
+	return p->num_pages;
+}
+
+static uint32_t * leaf_node_num_cells(void * node)
+{
+	return node + LEAF_NODE_NUM_CELLS_OFFSET;
+}
+
+static void * leaf_node_cell (void * node, uint32_t cell_num)
+{
+	return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+}
+
+static uint32_t * leaf_node_key (void * node, uint32_t cell_num)
+{
+	return leaf_node_cell(node, cell_num);
+}
+
+static void * leaf_node_value (void * node, uint32_t cell_num)
+{
+	return leaf_node_cell(node, cell_num) + LEAF_NODE_VALUE_OFFSET;
+}
+
+static uint32_t * internal_node_num_keys(void * node)
+{
+	return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
+}
+
+static uint32_t * internal_node_right_child(void * node)
+{
+	return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+}
+
+static uint32_t * internal_node_cell(void * node, uint32_t cell_num)
+{
+	return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+}
+
+static nodeType get_node_type(void * node)
+{
+	uint8_t value = *((uint8_t *)(node + NODE_TYPE_OFFSET));
+	return (nodeType)value;
+}
+
+static uint32_t * internal_node_child(void * node, uint32_t child_num)
+{
+	uint32_t num_keys = *internal_node_num_keys(node);
+	if(child_num > num_keys)
+	{
+		printf("Tried to access child_num %d > num_keys %d.\n", child_num, num_keys);
+		exit(EXIT_FAILURE);
+	}
+	// an invalid child page in a corrupt file is refused by the pager when it is fetched
+	else if(child_num == num_keys) return internal_node_right_child(node);
+	return internal_node_cell(node, child_num);
+}
+
+static uint32_t * internal_node_key(void * node, uint32_t key_num)
+{
+	return (void *)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+}
+
+static off_t page_offset(pager * p, uint32_t page_num)
+{
+	// widen before multiplying, page numbers past 4 GB / page size would overflow 32 bits
+	return (off_t)page_num * p->page_size;
+}
+
+/*
+	page codec, a byte oriented run length encoding: a control byte c below 128 is followed by c+1 literal bytes,
+	otherwise the next byte repeats c-128+3 times. rows are padded with NULs so most of a page is long runs
+*/
+static const uint32_t CODEC_MAX_LITERALS = 128;
+static const uint32_t CODEC_MIN_RUN = 3;
+static const uint32_t CODEC_MAX_RUN = 130;
+
+static uint32_t codec_run_length(const uint8_t * src, uint32_t length, uint32_t i)
+{
+	uint32_t run = 1;
+	while(i+run < length && run < CODEC_MAX_RUN && src[i+run] == src[i]) run++;
+	return run;
+}
+
+static uint32_t max_packed_size(uint32_t page_size)
+{
+	// incompressible data costs one control byte per 128 literals
+	return page_size + page_size / CODEC_MAX_LITERALS + 1;
+}
+
+static uint32_t page_compress(const uint8_t * src, uint32_t length, uint8_t * dest)
+{
+	uint32_t i = 0, out = 0;
+	while(i < length)
+	{
+		uint32_t run = codec_run_length(src, length, i);
+		if(run >= CODEC_MIN_RUN)
+		{
+			dest[out++] = 128 + (run - CODEC_MIN_RUN);
+			dest[out++] = src[i];
+			i += run;
+			continue;
+		}
+		uint32_t start = i;
+		while(i < length && i - start < CODEC_MAX_LITERALS && codec_run_length(src, length, i) < CODEC_MIN_RUN) i++;
+		dest[out++] = i - start - 1;
+		memcpy(dest + out, src + start, i - start);
+		out += i - start;
+	}
+	return out;
+}
+
+static bool page_decompress(const uint8_t * src, uint32_t src_length, uint8_t * dest, uint32_t length)
+{
+	uint32_t i = 0, out = 0;
+	while(i < src_length)
+	{
+		uint8_t control = src[i++];
+		if(control < 128)
+		{
+			uint32_t count = control + 1;
+			if(i + count > src_length || out + count > length) return false;
+			memcpy(dest + out, src + i, count);
+			i += count;
+			out += count;
+		}
+		else
+		{
+			uint32_t count = control - 128 + CODEC_MIN_RUN;
+			if(i >= src_length || out + count > length) return false;
+			memset(dest + out, src[i++], count);
+			out += count;
+		}
+	}
+	return out == length;
+}
+
+static uint32_t pack_page(pager * p, void * page, uint8_t * dest)
+{
+	// a page that does not shrink is stored as it is, its length is then the page size
+	uint32_t length = page_compress(page, p->page_size, dest);
+	if(length < p->page_size) return length;
+	memcpy(dest, page, p->page_size);
+	return p->page_size;
+}
+
+static statementTrace * pager_trace(pager * p)
+{
+	// only the thread that began the trace counts into it, backup and replica threads read pages too
+	if(p->trace && pthread_equal(p->trace_thread, pthread_self())) return p->trace;
+	return NULL;
+}
+
+static void pager_fail(pager * p, int error)
+{
+	// called with the pager lock held while other threads may read, later errors usually follow from the first one
+	if(p->error == 0) p->error = error;
+}
+
+static int pager_error(pager * p)
+{
+	pthread_mutex_lock(&(p->lock));
+	int error = p->error;
+	pthread_mutex_unlock(&(p->lock));
+	return error;
+}
+
+static void initialize_leaf_node(void * node);
+
+static void * pager_failed_page(pager * p)
+{
+	// a descent or scan that reaches a page that could not be read ends at an empty leaf
+	if(p->failed_page == NULL) p->failed_page = malloc(p->page_size);
+	memset(p->failed_page, 0, p->page_size);
+	initialize_leaf_node(p->failed_page);
+	return p->failed_page;
+}
+
+static bool node_header_valid(pager * p, void * node)
+{
+	// checked once when a page is read from the file, the code walking a node trusts its cell count
+	if(get_node_type(node) == NODE_LEAF) return *leaf_node_num_cells(node) <= p->leaf_node_max_cells;
+	return get_node_type(node) == NODE_INTERNAL && *internal_node_num_keys(node) <= p->internal_node_max_cells;
+}
+
+static bool pager_read_compressed_page(pager * p, uint32_t page_num, void * page)
+{
+	pageExtent * extent = &(p->page_map[page_num]);
+	if(extent->length == 0) return true; // allocated but never written
+	if(extent->length == p->page_size)
+	{
+		ssize_t bytes_read = pread(p->file_descriptor, page, p->page_size, extent->offset);
+		if(bytes_read != p->page_size)
+		{
+			pager_fail(p, bytes_read == -1 ? errno : EIO);
+			return false;
+		}
+	}
+	else
+	{
+		uint8_t * packed = malloc(extent->length);
+		ssize_t bytes_read = pread(p->file_descriptor, packed, extent->length, extent->offset);
+		int error = bytes_read == -1 ? errno : EIO;
+		// a short read or a page that does not decompress means a corrupt file
+		bool read = bytes_read == extent->length && page_decompress(packed, extent->length, page, p->page_size);
+		free(packed);
+		if(!read)
+		{
+			pager_fail(p, error);
+			return false;
+		}
+	}
+	if(!node_header_valid(p, page))
+	{
+		pager_fail(p, EIO);
+		return false;
+	}
+	statementTrace * trace = pager_trace(p);
+	if(trace) trace->bytes_read += extent->length;
+	return true;
+}
+
+static bool pager_valid_page_num(pager * p, uint32_t page_num)
+{
+	// inserts check for room before a split, so a page number out of range is a corrupt child pointer
+	if(page_num < TABLE_MAX_PAGES && page_num != HEADER_PAGE_NUM) return true;
+	pager_fail(p, EIO);
+	return false;
+}
+
+static void * pager_load_page(pager * p, uint32_t page_num)
+{
+	if(!pager_valid_page_num(p, page_num)) return pager_failed_page(p);
+	statementTrace * trace = pager_trace(p);
+	if(trace)
+	{
+		if(p->pages[page_num]) trace->page_hits++;
+		else trace->page_misses++;
+	}
+	if(p->pages[page_num] == NULL)
+	{
+		// cache miss, allocate memory and load file
+		void * page = malloc(p->page_size);
+		if(p->compressed && !pager_read_compressed_page(p, page_num, page))
+		{
+			free(page);
+			return pager_failed_page(p);
+		}
+		uint32_t num_pages = p->file_length / p->page_size;	
+		// we might save a partial page at the end of the file
+		if(p->file_length % p->page_size) num_pages += 1;
+		if(!(p->compressed) && page_num <= num_pages)
+		{
+			ssize_t bytes_read = pread(p->file_descriptor, page, p->page_size, page_offset(p, page_num));
+			// nothing is read past the end of the file, the caller initializes the new page
+			if(bytes_read == -1 || (bytes_read > 0 && !node_header_valid(p, page)))
+			{
+				pager_fail(p, bytes_read == -1 ? errno : EIO);
+				free(page);
+				return pager_failed_page(p);
+			}
+			if(trace) trace->bytes_read += bytes_read;
+		} 
+		p->pages[page_num] = page;	
+		if(page_num >= p->num_pages) p->num_pages = page_num+1;
+	}
+	return p->pages[page_num];
+}
+
+static void * get_page(pager * p, uint32_t page_num)
+{
+	pthread_mutex_lock(&(p->lock));
+	void * page = pager_load_page(p, page_num);
+	pthread_mutex_unlock(&(p->lock));
+	return page;
+}
+
+static void * get_page_for_write(pager * p, uint32_t page_num)
+{
+	/*
+		every page that is about to be modified is fetched through here, if a snapshot was taken since the page
+		was last saved, the current buffer becomes a read-only version for the snapshots, which may already be
+		reading it on another thread, and the writer changes a private copy published as the live page
+	*/
+	pthread_mutex_lock(&(p->lock));
+	void * page = pager_load_page(p, page_num);
+	if(page == p->failed_page)
+	{
+		pthread_mutex_unlock(&(p->lock));
+		return page;
+	}
+	// cells may move, hash index entries pointing into the page are stale from here
+	p->page_write_count[page_num]++;
+	if(p->num_snapshots == 0 || page_num >= p->latest_snapshot_num_pages || p->page_saved_epoch[page_num] > p->latest_snapshot_epoch)
+	{
+		// no snapshot needs the current contents, or they were saved already
+		pthread_mutex_unlock(&(p->lock));
+		return page;
+	}
+	pageVersion * version = malloc(sizeof(pageVersion));
+	version->epoch = p->epoch;
+	version->data = page;
+	version->next = NULL;
+	pageVersion ** tail = &(p->page_versions[page_num]);
+	while(*tail) tail = &((*tail)->next);
+	*tail = version;
+	void * copy = malloc(p->page_size);
+	memcpy(copy, page, p->page_size);
+	p->pages[page_num] = copy;
+	p->page_saved_epoch[page_num] = p->epoch;
+	pthread_mutex_unlock(&(p->lock));
+	return copy;
+}
+
+static snapshot * snapshot_open(table * t)
+{
+	/*
+		pin the current version of the tree, writes after this point no longer change what the snapshot reads;
+		the caller holds the write lock so no write is half done
+	*/
+	pager * p = t->p;
+	snapshot * s = malloc(sizeof(snapshot));
+	pthread_mutex_lock(&(p->lock));
+	s->t = t;
+	s->epoch = p->epoch;
+	s->root_page_num = t->root_page_num;
+	s->num_pages = p->num_pages;
+	s->next = t->snapshots;
+	t->snapshots = s;
+	p->num_snapshots++;
+	p->latest_snapshot_epoch = p->epoch;
+	p->latest_snapshot_num_pages = p->num_pages;
+	p->epoch++;
+	pthread_mutex_unlock(&(p->lock));
+	return s;
+}
+
+static void * snapshot_load_page(snapshot * s, uint32_t page_num)
+{
+	// the oldest copy saved after the snapshot was taken, or the live page if it was not written since
+	pager * p = s->t->p;
+	if(!pager_valid_page_num(p, page_num)) return pager_failed_page(p);
+	for(pageVersion * version = p->page_versions[page_num]; version; version = version->next)
+	{
+		if(version->epoch > s->epoch)
+		{
+			statementTrace * trace = pager_trace(p);
+			if(trace) trace->page_hits++;
+			return version->data;
+		}
+	}
+	return pager_load_page(p, page_num);
+}
+
+static void * snapshot_get_page(snapshot * s, uint32_t page_num)
+{
+	pager * p = s->t->p;
+	pthread_mutex_lock(&(p->lock));
+	void * page = snapshot_load_page(s, page_num);
+	pthread_mutex_unlock(&(p->lock));
+	return page;
+}
+
+static bool page_version_in_use(table * t, uint32_t prev_epoch, uint32_t epoch)
+{
+	// a version is read by the snapshots taken at or after the previous version's epoch and before its own
+	for(snapshot * s = t->snapshots; s; s = s->next)
+	{
+		if(s->epoch >= prev_epoch && s->epoch < epoch) return true;
+	}
+	return false;
+}
+
+static void snapshot_close(snapshot * s)
+{
+	table * t = s->t;
+	pager * p = t->p;
+	pthread_mutex_lock(&(p->lock));
+	snapshot ** link = &(t->snapshots);
+	while(*link != s) link = &((*link)->next);
+	*link = s->next;
+	p->num_snapshots--;
+	free(s);
+	// reclaim the versions no open snapshot can read anymore
+	for(uint32_t i = 0; i<TABLE_MAX_PAGES; i++)
+	{
+		uint32_t prev_epoch = 0;
+		pageVersion ** link_version = &(p->page_versions[i]);
+		while(*link_version)
+		{
+			pageVersion * version = *link_version;
+			uint32_t epoch = version->epoch;
+			if(page_version_in_use(t, prev_epoch, epoch)) link_version = &(version->next);
+			else
+			{
+				*link_version = version->next;
+				free(version->data);
+				free(version);
+			}
+			prev_epoch = epoch;
+		}
+	}
+	pthread_mutex_unlock(&(p->lock));
+}
+
+static void * read_page(table * t, snapshot * s, uint32_t page_num)
+{
+	if(s) return snapshot_get_page(s, page_num);
+	return get_page(t->p, page_num);
+}
+
+static uint32_t get_node_max_key(pager * p, void * node)
+{
+	// only a page that could not be read is an empty leaf
+	if(get_node_type(node) == NODE_LEAF) return *leaf_node_num_cells(node) == 0 ? 0 : *leaf_node_key(node, *leaf_node_num_cells(node)-1);
+	void * right_child = get_page(p, *internal_node_right_child(node));
+	return get_node_max_key(p, right_child);
+}
+
+static uint32_t * node_parent(void * node) 
+{
+	return node + PARENT_POINTER_OFFSET;
+}
+
+static bool is_node_root(void * node)
+{
+	uint8_t value = *((uint8_t *)(node + IS_ROOT_OFFSET));
+	return (bool)value;
+}
+
+static void set_node_root(void * node, bool is_root)
+{
+	uint8_t value = is_root;	
+	*((uint8_t *)(node + IS_ROOT_OFFSET)) = value;
+}
+
+static void set_node_type(void * node, nodeType type)
+{
+	uint8_t value = type;
+	*((uint8_t *)(node + NODE_TYPE_OFFSET)) = value;
+}
+
+static void initialize_leaf_node(void * node)
+{
+	set_node_type(node, NODE_LEAF);
+	set_node_root(node, false);
+	*leaf_node_num_cells(node) = 0;
+	*leaf_node_next_leaf(node) = 0;
+}
+
+static void initialize_internal_node(void * node)
+{
+	set_node_type(node, NODE_INTERNAL);
+	set_node_root(node, false);
+	*internal_node_num_keys(node) = 0;
+	/*
+		necessary because page 0 is the file header; by not initializing an internal node's right child
+		to an invalid page number when initializing the node, we may end up with 0 as the node's right child
+		which makes the node a parent of the header
+	*/
+	*internal_node_right_child(node) = INVALID_PAGE_NUM;
+}
+
+static void indent(uint32_t level)
+{
+	for(uint32_t i = 0; i<level; i++) printf(" ");
+}
+
+static void print_tree(pager * p, uint32_t page_num, uint32_t indentation_level)
+{
+	void * node = get_page(p, page_num);
+	uint32_t num_keys, child;
+	switch(get_node_type(node))
+	{
+		case NODE_LEAF:	
+			num_keys = *leaf_node_num_cells(node);
+			indent(indentation_level);
+			printf("- leaf (size %d)\n", num_keys);
+			for(uint32_t i = 0; i<num_keys; i++)
+			{
+				indent(indentation_level+1);
+				printf("- %d\n", *leaf_node_key(node, i));
+			}
+			break;
+		case NODE_INTERNAL:
+			num_keys = *internal_node_num_keys(node);
+			indent(indentation_level);
+			printf("- internal (size %d)\n", num_keys);
+			if(num_keys > 0)
+			{
+				for(uint32_t i = 0; i<num_keys; i++)
+				{
+					child = *internal_node_child(node, i);	
+					print_tree(p, child, indentation_level+1);	
+					indent(indentation_level+1);
+					printf("- key %d\n", *internal_node_key(node, i));
+				}
+				child = *internal_node_right_child(node);
+				print_tree(p, child, indentation_level+1);
+			}
+			break;
+	}
+}
+
+void db_print_tree(table * t)
+{
+	print_tree(t->p, t->root_page_num, 0);
+}
+
+/*
+return the position of the given key
+if key is not present, return the position where it should be inserted
+*/
+
+static cursor * leaf_node_find(table * t, snapshot * s, uint32_t page_num, uint32_t key)
+{
+	statementTrace * trace = pager_trace(t->p);
+	if(trace) trace->levels++;
+	void * node = read_page(t, s, page_num);
+	uint32_t num_cells = *leaf_node_num_cells(node);
+	cursor * c = malloc(sizeof(cursor));
+	c->t = t;
+	c->s = s;
+	c->page_num = page_num;
+	// bin search for the first cell whose key is not less than the given key
+	uint32_t l = 0, r = num_cells;
+	while(l < r)
+	{
+		uint32_t mid = (l+r)/2;
+		uint32_t key_at_mid = *leaf_node_key(node, mid);
+		if(key_at_mid < key) l = mid+1;	
+		else r = mid;
+	}	
+	c->cell_num = l;	
+	return c;
+}
+
+// return the index of the child which should contain the key
+static uint32_t internal_node_find_child(void * node, uint32_t key)
+{
+	uint32_t num_keys = *internal_node_num_keys(node);
+	// binary search to find index of child to search
+	uint32_t l = -1, r = num_keys;	
+	while(l+1<r)
+	{
+		uint32_t mid = l+(r-l)/2;
+		uint32_t key_to_right = *internal_node_key(node, mid);
+		if(key_to_right >= key) r = mid;
+		else l = mid;
+	}
+	return r;
+}
+
+static cursor * internal_node_find(table * t, snapshot * s, uint32_t page_num, uint32_t key)
+{
+	statementTrace * trace = pager_trace(t->p);
+	if(trace) trace->levels++;
+	void * node = read_page(t, s, page_num);
+	uint32_t child_index = internal_node_find_child(node, key);
+	uint32_t child_num = *internal_node_child(node, child_index);
+	void * child = read_page(t, s, child_num);	
+	switch(get_node_type(child))
+	{
+		case NODE_LEAF:
+			return leaf_node_find(t, s, child_num, key);
+		case NODE_INTERNAL:
+			return internal_node_find(t, s, child_num, key);
+	}
+}
+
+static cursor * tree_find(table * t, snapshot * s, uint32_t root_page_num, uint32_t key)
+{
+	void * root_node = read_page(t, s, root_page_num);
+	if(get_node_type(root_node) == NODE_LEAF) return leaf_node_find(t, s, root_page_num, key);
+	else return internal_node_find(t, s, root_page_num, key);
+}
+
+static cursor * table_find(table * t, uint32_t key)
+{
+	return tree_find(t, NULL, t->root_page_num, key);
+}
+
+static cursor * snapshot_find(snapshot * s, uint32_t key)
+{
+	return tree_find(s->t, s, s->root_page_num, key);
+}
+
+static cursor * cursor_start(cursor * c)
+{
+	void * node = read_page(c->t, c->s, c->page_num);
+	uint32_t num_cells = *leaf_node_num_cells(node);
+	c->end_of_table = (num_cells == 0);
+	return c;
+}
+
+static cursor * table_start(table * t)
+{	
+	return cursor_start(table_find(t, 0));
+}
+
+static cursor * snapshot_start(snapshot * s)
+{
+	return cursor_start(snapshot_find(s, 0));
+}
+
+static void cursor_advance(cursor * c)
+{
+	uint32_t page_num = c->page_num;	
+	void * node = read_page(c->t, c->s, page_num);
+	c->cell_num += 1;
+	if(c->cell_num >= (*leaf_node_num_cells(node)))	
+	{
+		// advance to the next leaf node
+		uint32_t next_page_num = *leaf_node_next_leaf(node);
+		if(next_page_num == 0) c->end_of_table = true; // rightmost leaf
+		else 
+		{
+			c->page_num = next_page_num;
+			c->cell_num = 0;
+		}
+	} 
+}
+
+// follow the right children down to the last leaf of the subtree
+static uint32_t rightmost_leaf(table * t, snapshot * s, uint32_t page_num)
+{
+	statementTrace * trace = pager_trace(t->p);
+	void * node = read_page(t, s, page_num);
+	while(get_node_type(node) == NODE_INTERNAL)
+	{
+		if(trace) trace->levels++;
+		page_num = *internal_node_right_child(node);
+		node = read_page(t, s, page_num);
+	}
+	if(trace) trace->levels++;
+	return page_num;
+}
+
+static cursor * snapshot_end(snapshot * s)
+{
+	cursor * c = malloc(sizeof(cursor));
+	c->t = s->t;
+	c->s = s;
+	c->page_num = rightmost_leaf(s->t, s, s->root_page_num);
+	uint32_t num_cells = *leaf_node_num_cells(read_page(s->t, s, c->page_num));
+	c->cell_num = num_cells == 0 ? 0 : num_cells-1;
+	c->end_of_table = (num_cells == 0);
+	return c;
+}
+
+static void cursor_retreat(cursor * c)
+{
+	if(c->cell_num > 0)
+	{
+		c->cell_num -= 1;
+		return;
+	}
+	/*
+		leaves only link forward, so descend again towards the first key of this leaf and remember 
+		the last subtree passed on its left, the rightmost leaf of that subtree comes just before this one
+	*/
+	uint32_t first_key = *leaf_node_key(read_page(c->t, c->s, c->page_num), 0);
+	uint32_t page_num = c->s ? c->s->root_page_num : c->t->root_page_num;
+	uint32_t left_page_num = INVALID_PAGE_NUM;
+	void * node = read_page(c->t, c->s, page_num);
+	while(get_node_type(node) == NODE_INTERNAL)
+	{
+		uint32_t child_index = internal_node_find_child(node, first_key);
+		if(child_index > 0) left_page_num = *internal_node_child(node, child_index-1);
+		page_num = *internal_node_child(node, child_index);
+		node = read_page(c->t, c->s, page_num);
+	}
+	if(left_page_num == INVALID_PAGE_NUM) 
+	{
+		c->end_of_table = true; // leftmost leaf
+		return;
+	}
+	c->page_num = rightmost_leaf(c->t, c->s, left_page_num);
+	c->cell_num = *leaf_node_num_cells(read_page(c->t, c->s, c->page_num)) - 1;
+}
+
+static void create_new_root(table * t, uint32_t right_child_page_num)
+{
+	/*
+		handle splitting the root
+		old root copied to new page, becomes the left child
+		address of right child passed in 
+		re-initialize root page to contain the new root node
+		new root node points to two children
+	*/
+	void * root = get_page_for_write(t->p, t->root_page_num);
+	void * right_child = get_page_for_write(t->p, right_child_page_num);
+	uint32_t left_child_page_num = get_unused_page_num(t->p);
+	void * left_child = get_page_for_write(t->p, left_child_page_num);
+	if(get_node_type(root) == NODE_INTERNAL)
+	{
+		initialize_internal_node(right_child);	
+		initialize_internal_node(left_child);
+	}
+	// left child has data copied from old root
+	memcpy(left_child, root, t->p->page_size);	
+	set_node_root(left_child, false);
+	if(get_node_type(left_child) == NODE_INTERNAL)
+	{
+		void * child;
+		for(int i = 0; i < *internal_node_num_keys(left_child); i++)
+		{
+			child = get_page_for_write(t->p, *internal_node_child(left_child, i));
+			*node_parent(child) = left_child_page_num;
+		}
+		child = get_page_for_write(t->p, *internal_node_right_child(left_child));
+		*node_parent(child) = left_child_page_num;
+	}
+	// root node is a new internal node with one key and two children
+	initialize_internal_node(root);	
+	set_node_root(root, true);
+	*internal_node_num_keys(root) = 1;
+	*internal_node_child(root, 0) = left_child_page_num;
+	uint32_t left_child_max_key = get_node_max_key(t->p, left_child);
+	*internal_node_key(root, 0) = left_child_max_key;
+	*internal_node_right_child(root) = right_child_page_num;
+	*node_parent(left_child) = t->root_page_num;
+	*node_parent(right_child) = t->root_page_num;
+}
+
+static void update_internal_node_key(void * node, uint32_t old_key, uint32_t new_key)
+{
+	uint32_t old_child_index = internal_node_find_child(node, old_key);
+	*internal_node_key(node, old_child_index) = new_key;
+}
+
+static void internal_node_split_and_insert(table * t, uint32_t parent_page_num, uint32_t child_page_num);
+
+static void internal_node_insert(table * t, uint32_t parent_page_num, uint32_t child_page_num)
+{
+	// add a new child/key pair to parent that corresponds to child
+	void * parent = get_page_for_write(t->p, parent_page_num);
+	void * child = get_page(t->p, child_page_num);
+	uint32_t child_max_key = get_node_max_key(t->p, child);
+	uint32_t index = internal_node_find_child(parent, child_max_key);
+	uint32_t original_num_keys = *internal_node_num_keys(parent);
+	if(original_num_keys >= t->p->internal_node_max_cells)
+	{
+		internal_node_split_and_insert(t, parent_page_num, child_page_num);
+		return;
+	}
+	uint32_t right_child_page_num = *internal_node_right_child(parent);
+	// internal node with a right child of INVALID_PAGE_NUM is empty
+	if(right_child_page_num == INVALID_PAGE_NUM) 
+	{
+		*internal_node_right_child(parent) = child_page_num;
+		return;
+	}
+	void * right_child = get_page(t->p, right_child_page_num);
+	/*
+		if we are already at the max number of cells for a node, we can't increment before splitting
+		incrementing without inserting a new key/child pair and immediately calling internal_node_split_and_insert
+		has the effect of creating a new key at (max_cells+1) with an uninitialized value
+	*/
+	*internal_node_num_keys(parent) = original_num_keys+1;
+	if(child_max_key > get_node_max_key(t->p, right_child))
+	{
+		// replace right child
+		*internal_node_child(parent, original_num_keys) = right_child_page_num;
+		*internal_node_key(parent, original_num_keys) = get_node_max_key(t->p, right_child);
+		*internal_node_right_child(parent) = child_page_num;
+	}
+	else
+	{
+		// make room for new cell
+		for(uint32_t i = original_num_keys; i > index; i--)
+		{
+			void * destination = internal_node_cell(parent, i);
+			void * source = internal_node_cell(parent, i-1);
+			memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+		}
+		*internal_node_child(parent, index) = child_page_num;	
+		*internal_node_key(parent, index) = child_max_key;
+	}
+}
+
+static void internal_node_split_and_insert(table * t, uint32_t parent_page_num, uint32_t child_page_num)
+{
+	statementTrace * trace = pager_trace(t->p);
+	if(trace) trace->internal_splits++;
+	uint32_t old_page_num = parent_page_num;	
+	void * old_node = get_page_for_write(t->p, parent_page_num);
+	uint32_t old_max = get_node_max_key(t->p, old_node);
+	void * child = get_page_for_write(t->p, child_page_num);
+	uint32_t child_max = get_node_max_key(t->p, child);
+	uint32_t new_page_num = get_unused_page_num(t->p);
+	/*
+		Declaring a flag before updating pointers which records whether this operation involves splitting the 
+		root - if it does, we will insert our newly created node during the step where the table's new root is 
+		created. If it does not, we have to insert the newly created node into it's parent after the old node's
+		keys have been transferred over. We are not able to do this if the newly created node's parent is not a 
+		newly initialized root node, because in that case it's parent may have existing keys aside from our old
+		node which we are splitting. If that is true, we need to find a place for our newly created node in it's
+		parent, and we can't insert it at the correct index if it does not yet have any keys
+	*/
+	uint32_t splitting_root = is_node_root(old_node);
+	void * parent, * new_node;
+	if(splitting_root)
+	{
+		create_new_root(t, new_page_num);
+		parent = get_page_for_write(t->p, t->root_page_num);
+		/*
+			If we are splitting the root, we need to update old_node to point to the new root's left child,
+			new_page_num will already point to the new root's right child
+		*/
+		old_page_num = *internal_node_child(parent, 0);
+		old_node = get_page_for_write(t->p, old_page_num);
+	}
+	else
+	{
+		parent = get_page_for_write(t->p, *node_parent(old_node));
+		new_node = get_page_for_write(t->p, new_page_num);
+		initialize_internal_node(new_node);
+	}
+	uint32_t * old_num_keys = internal_node_num_keys(old_node);
+	uint32_t cur_page_num = *internal_node_right_child(old_node);
+	void * cur = get_page_for_write(t->p, cur_page_num);
+	// first put right child into new node and set right child of old node to invalid page number
+	internal_node_insert(t, new_page_num, cur_page_num);
+	*node_parent(cur) = new_page_num;	
+	*internal_node_right_child(old_node) = INVALID_PAGE_NUM;
+	// for each key until you get to the middle key, move the key and the child to the new node
+	int32_t max_cells = t->p->internal_node_max_cells;
+	for(int i = max_cells-1; i > max_cells/2; i--)
+	{
+		cur_page_num = *internal_node_child(old_node, i);
+		cur = get_page_for_write(t->p, cur_page_num);
+		internal_node_insert(t, new_page_num, cur_page_num);
+		*node_parent(cur) = new_page_num;
+		(*old_num_keys)--;
+	}
+	// set child before middle key, which is now the highest key, to be node's right child, and decrement number of keys
+	*internal_node_right_child(old_node) = *internal_node_child(old_node, *old_num_keys-1);
+	(*old_num_keys)--;
+	// determine which of the two nodes after the split should contain the child to be inserted, and insert the child
+	uint32_t max_after_split = get_node_max_key(t->p, old_node);
+	uint32_t destination_page_num = child_max < max_after_split ? old_page_num : new_page_num;
+	internal_node_insert(t, destination_page_num, child_page_num);
+	*node_parent(child) = destination_page_num;
+	update_internal_node_key(parent, old_max, get_node_max_key(t->p, old_node));
+	if(!splitting_root)
+	{
+		// set the parent before inserting, the insert may split the parent and move the new node elsewhere
+		*node_parent(new_node) = *node_parent(old_node);
+		internal_node_insert(t, *node_parent(old_node), new_page_num);
+	}
+}
+
+static void serialize_row(row * src, void * dest)
+{
+	memcpy(dest + ID_OFFSET, &(src->id), ID_SIZE);
+	memcpy(dest + USERNAME_OFFSET, &(src->username), USERNAME_SIZE);
+	memcpy(dest + EMAIL_OFFSET, &(src->email), EMAIL_SIZE);
+}
+
+void deserialize_row(const void * src, row* dest)
+{
+	memcpy(&(dest->id), src+ID_OFFSET, ID_SIZE);
+	memcpy(&(dest->username), src+USERNAME_OFFSET, USERNAME_SIZE);
+	memcpy(&(dest->email), src+EMAIL_OFFSET, EMAIL_SIZE);
+}
+
+static void * cursor_value(cursor * c)
+{
+	uint32_t page_num = c->page_num;
+	void * page = read_page(c->t, c->s, page_num);
+	return leaf_node_value(page, c->cell_num);
+}
+
+static bool read_header_field(pager * p, void * field, uint32_t size, uint32_t offset)
+{
+	// a header cut short is a corrupt file
+	ssize_t bytes_read = pread(p->file_descriptor, field, size, offset);
+	if(bytes_read == size) return true;
+	if(bytes_read != -1) errno = EIO;
+	return false;
+}
+
+static uint32_t header_page_map_offset(uint32_t num_hot_pages)
+{
+	return HEADER_HOT_PAGES_OFFSET + num_hot_pages * HEADER_HOT_PAGE_SIZE;
+}
+
+static uint32_t pager_max_pages(pager * p)
+{
+	// the page map of a compressed file has to fit in the header page
+	uint32_t max_pages = TABLE_MAX_PAGES;
+	if(p->compressed && (p->page_size - HEADER_SIZE) / PAGE_MAP_ENTRY_SIZE < max_pages) max_pages = (p->page_size - HEADER_SIZE) / PAGE_MAP_ENTRY_SIZE;
+	return max_pages;
+}
+
+static int compare_extent_offsets(const void * a, const void * b)
+{
+	uint64_t offset_a = ((const pageExtent *)a)->offset, offset_b = ((const pageExtent *)b)->offset;
+	return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
+static void remove_free_extent(pager * p, uint32_t i)
+{
+	p->num_free_extents--;
+	memmove(&(p->free_extents[i]), &(p->free_extents[i+1]), (p->num_free_extents - i) * sizeof(pageExtent));
+}
+
+static void extent_release(pager * p, uint64_t offset, uint32_t capacity)
+{
+	// the free list stays sorted with neighbours merged, space freed at the end of the file shrinks the file
+	uint32_t i = 0;
+	while(i < p->num_free_extents && p->free_extents[i].offset < offset) i++;
+	memmove(&(p->free_extents[i+1]), &(p->free_extents[i]), (p->num_free_extents - i) * sizeof(pageExtent));
+	p->num_free_extents++;
+	p->free_extents[i].offset = offset;
+	p->free_extents[i].length = 0;
+	p->free_extents[i].capacity = capacity;
+	if(i+1 < p->num_free_extents && offset + capacity == p->free_extents[i+1].offset)
+	{
+		p->free_extents[i].capacity += p->free_extents[i+1].capacity;
+		remove_free_extent(p, i+1);
+	}
+	if(i > 0 && p->free_extents[i-1].offset + p->free_extents[i-1].capacity == offset)
+	{
+		p->free_extents[i-1].capacity += p->free_extents[i].capacity;
+		remove_free_extent(p, i);
+		i--;
+	}
+	if(p->free_extents[i].offset + p->free_extents[i].capacity == p->file_end)
+	{
+		p->file_end = p->free_extents[i].offset;
+		remove_free_extent(p, i);
+	}
+}
+
+static uint64_t extent_allocate(pager * p, uint32_t capacity)
+{
+	// first fit, the rest of a larger free extent stays free, the file only grows when nothing fits
+	for(uint32_t i = 0; i<p->num_free_extents; i++)
+	{
+		pageExtent * free_extent = &(p->free_extents[i]);
+		if(free_extent->capacity < capacity) continue;
+		uint64_t offset = free_extent->offset;
+		free_extent->offset += capacity;
+		free_extent->capacity -= capacity;
+		if(free_extent->capacity == 0) remove_free_extent(p, i);
+		return offset;
+	}
+	uint64_t offset = p->file_end;
+	p->file_end += capacity;
+	return offset;
+}
+
+static bool pager_read_page_map(pager * p, uint32_t num_hot_pages)
+{
+	// the hot list only names pages of the file, the map has an entry per page; extents may not overlap
+	if(num_hot_pages > p->num_pages || header_page_map_offset(num_hot_pages) + p->num_pages * PAGE_MAP_ENTRY_SIZE > p->page_size)
+	{
+		errno = EIO;
+		return false;
+	}
+	uint8_t map[TABLE_MAX_PAGES * PAGE_MAP_ENTRY_SIZE];
+	if(!read_header_field(p, map, p->num_pages * PAGE_MAP_ENTRY_SIZE, header_page_map_offset(num_hot_pages))) return false;
+	memset(p->page_map, 0, sizeof(p->page_map));
+	pageExtent used[TABLE_MAX_PAGES];
+	uint32_t num_used = 0;
+	for(uint32_t i = 0; i<p->num_pages; i++)
+	{
+		uint8_t * entry = map + i * PAGE_MAP_ENTRY_SIZE;
+		pageExtent * extent = &(p->page_map[i]);
+		extent->offset = *(uint64_t *)entry;
+		extent->length = *(uint32_t *)(entry + PAGE_MAP_OFFSET_SIZE);
+		extent->capacity = *(uint32_t *)(entry + PAGE_MAP_OFFSET_SIZE + PAGE_MAP_LENGTH_SIZE);
+		if(extent->length == 0) continue;
+		if(extent->length > p->page_size || extent->length > extent->capacity || extent->offset + extent->length > p->file_length)
+		{
+			errno = EIO;
+			return false;
+		}
+		used[num_used++] = *extent;
+	}
+	// the gaps between the extents are the free list
+	qsort(used, num_used, sizeof(pageExtent), compare_extent_offsets);
+	p->num_free_extents = 0;
+	p->file_end = p->page_size;
+	for(uint32_t i = 0; i<num_used; i++)
+	{
+		if(used[i].offset < p->file_end)
+		{
+			errno = EIO;
+			return false;
+		}
+		if(used[i].offset > p->file_end)
+		{
+			p->free_extents[p->num_free_extents].offset = p->file_end;
+			p->free_extents[p->num_free_extents].length = 0;
+			p->free_extents[p->num_free_extents].capacity = used[i].offset - p->file_end;
+			p->num_free_extents++;
+		}
+		p->file_end = used[i].offset + used[i].capacity;
+	}
+	return true;
+}
+
+static void write_page_map(void * header, pageExtent * page_map)
+{
+	// after the hot list, which has to be in the header already
+	uint32_t num_pages = *(uint32_t *)(header + HEADER_NUM_PAGES_OFFSET);
+	uint32_t map_offset = header_page_map_offset(*(uint32_t *)(header + HEADER_NUM_HOT_PAGES_OFFSET));
+	for(uint32_t i = 0; i<num_pages; i++)
+	{
+		void * entry = header + map_offset + i * PAGE_MAP_ENTRY_SIZE;
+		*(uint64_t *)entry = page_map[i].offset;
+		*(uint32_t *)(entry + PAGE_MAP_OFFSET_SIZE) = page_map[i].length;
+		*(uint32_t *)(entry + PAGE_MAP_OFFSET_SIZE + PAGE_MAP_LENGTH_SIZE) = page_map[i].capacity;
+	}
+}
+
+static pager * pager_open_failed(pager * p, int error)
+{
+	close(p->file_descriptor);
+	free(p);
+	errno = error;
+	return NULL;
+}
+
+static pager * pager_open(const char * filename, uint32_t page_size, bool compressed)
+{
+	int fd = open(filename, O_RDWR|O_CREAT, S_IWUSR|S_IRUSR);
+	if(fd == -1) return NULL;
+	off_t file_length = lseek(fd, 0, SEEK_END);
+	pager * p = malloc(sizeof(pager));
+	p->file_descriptor = fd;
+	p->file_length = file_length;
+	if(file_length == 0)
+	{
+		// new db file, the page size is only chosen here
+		if(!is_valid_page_size(page_size)) return pager_open_failed(p, EINVAL);
+		set_page_layout(p, page_size);
+		p->num_pages = 1; // the header page
+		p->compressed = compressed;
+		memset(p->page_map, 0, sizeof(p->page_map));
+		p->num_free_extents = 0;
+		p->file_end = p->page_size;
+	}
+	else
+	{
+		// not a db file, an unknown version or a header that does not describe the file is a corrupt file
+		uint8_t header[HEADER_SIZE];
+		if(!read_header_field(p, header, HEADER_SIZE, 0)) return pager_open_failed(p, errno);
+		if(*(uint32_t *)(header + HEADER_MAGIC_OFFSET) != DB_FILE_MAGIC) return pager_open_failed(p, EIO);
+		uint32_t version = *(uint32_t *)(header + HEADER_VERSION_OFFSET);
+		if(version != DB_FILE_VERSION && version != DB_FILE_VERSION_COMPRESSED) return pager_open_failed(p, EIO);
+		uint32_t file_page_size = *(uint32_t *)(header + HEADER_PAGE_SIZE_OFFSET);
+		if(!is_valid_page_size(file_page_size)) return pager_open_failed(p, EIO);
+		set_page_layout(p, file_page_size);
+		p->num_pages = *(uint32_t *)(header + HEADER_NUM_PAGES_OFFSET);
+		p->compressed = version == DB_FILE_VERSION_COMPRESSED;
+		// the cache and every per page array hold TABLE_MAX_PAGES pages
+		if(p->num_pages <= HEADER_PAGE_NUM+1 || p->num_pages > pager_max_pages(p)) return pager_open_failed(p, EIO);
+		if(p->compressed && !pager_read_page_map(p, *(uint32_t *)(header + HEADER_NUM_HOT_PAGES_OFFSET))) return pager_open_failed(p, errno);
+		if(!(p->compressed) && (file_length % p->page_size != 0 || file_length / p->page_size < p->num_pages)) return pager_open_failed(p, EIO);
+	}
+	for(uint32_t i = 0; i<TABLE_MAX_PAGES; i++) 
+	{
+		p->pages[i] = NULL;
+		p->page_saved_epoch[i] = 0;
+		p->page_versions[i] = NULL;
+		p->page_write_count[i] = 0;
+	}
+	p->epoch = 1;
+	p->num_snapshots = 0;
+	p->latest_snapshot_epoch = 0;
+	p->latest_snapshot_num_pages = 0;
+	p->trace = NULL;
+	p->error = 0;
+	p->failed_page = NULL;
+	pthread_mutex_init(&(p->lock), NULL);
+	return p;
+}
+
+static table * table_open(const char * filename, uint32_t page_size, bool compressed)
+{
+	pager * p = pager_open(filename, page_size, compressed);
+	if(p == NULL) return NULL;
+	// a new file puts its root leaf on the first page after the header
+	uint64_t lsn = 0;
+	uint32_t root_page_num = get_unused_page_num(p);
+	if(p->file_length > 0)
+	{
+		int error = 0;
+		if(!read_header_field(p, &lsn, HEADER_LSN_SIZE, HEADER_LSN_OFFSET) || !read_header_field(p, &root_page_num, HEADER_ROOT_PAGE_SIZE, HEADER_ROOT_PAGE_OFFSET)) error = errno;
+		else if(root_page_num == HEADER_PAGE_NUM || root_page_num >= p->num_pages) error = EIO;
+		if(error != 0)
+		{
+			pthread_mutex_destroy(&(p->lock));
+			pager_open_failed(p, error);
+			return NULL;
+		}
+	}
+	table * t = malloc(sizeof(table));
+	t->p = p;
+	t->snapshots = NULL;
+	t->running_backup = NULL;
+	t->buffer = NULL;
+	t->hash_index = malloc(HASH_INDEX_SLOTS * sizeof(hashIndexEntry));
+	for(uint32_t i = 0; i<HASH_INDEX_SLOTS; i++) 
+	{
+		t->hash_index[i].lookups = 0;
+		t->hash_index[i].page_num = INVALID_PAGE_NUM;
+	}
+	t->replication_log = -1;
+	t->source = NULL;
+	pthread_mutex_init(&(t->write_lock), NULL);
+	t->lsn = lsn;
+	t->root_page_num = root_page_num;
+	if(p->file_length == 0)
+	{
+		// new db file, make page 1 as leaf node
+		void * root_node = get_page_for_write(p, t->root_page_num);
+		initialize_leaf_node(root_node);
+		set_node_root(root_node, true);
+	}
+	return t;
+}
+
+table * db_open(const char * filename, uint32_t page_size)
+{
+	return table_open(filename, page_size, false);
+}
+
+table * db_open_compressed(const char * filename, uint32_t page_size)
+{
+	return table_open(filename, page_size, true);
+}
+
+static int compare_page_nums(const void * a, const void * b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void pager_load_pages(pager * p, uint32_t * page_nums, uint32_t count)
+{
+	/*
+		load the given pages, sorted by page number, into the cache; pages next to each other in the file are
+		read with a single preadv straight into their page buffers
+	*/
+	struct iovec iov[TABLE_MAX_PAGES];
+	uint32_t i = 0;
+	pthread_mutex_lock(&(p->lock));
+	// compressed pages have to be decompressed one at a time, sorting still keeps the reads in file order
+	for(; p->compressed && i < count; i++)
+	{
+		if(p->page_map[page_nums[i]].length > 0) pager_load_page(p, page_nums[i]);
+	}
+	while(i < count)
+	{
+		uint32_t run_start = page_nums[i], run_length = 0;
+		while(i < count && page_nums[i] == run_start + run_length)
+		{
+			uint32_t page_num = page_nums[i++];
+			bool on_disk = page_offset(p, page_num) + p->page_size <= p->file_length;
+			if(p->pages[page_num] != NULL || !on_disk) break;
+			iov[run_length].iov_base = malloc(p->page_size);
+			iov[run_length].iov_len = p->page_size;
+			run_length++;
+		}
+		if(run_length == 0) continue;
+		ssize_t bytes_read = preadv(p->file_descriptor, iov, run_length, page_offset(p, run_start));
+		if(bytes_read != (ssize_t)run_length * p->page_size)
+		{
+			pager_fail(p, bytes_read == -1 ? errno : EIO);
+			for(uint32_t j = 0; j<run_length; j++) free(iov[j].iov_base);
+			continue;
+		}
+		for(uint32_t j = 0; j<run_length; j++)
+		{
+			if(node_header_valid(p, iov[j].iov_base)) p->pages[run_start+j] = iov[j].iov_base;
+			else
+			{
+				pager_fail(p, EIO);
+				free(iov[j].iov_base);
+			}
+		}
+	}
+	pthread_mutex_unlock(&(p->lock));
+}
+
+void db_warm_cache(table * t)
+{
+	// reload the pages that were cached when the database was last closed
+	pager * p = t->p;
+	// a new file has no header yet and nothing to warm
+	if(p->file_length == 0) return;
+	uint32_t num_hot_pages, page_nums[TABLE_MAX_PAGES], count = 0;
+	// the list is only a hint, one that cannot be read is taken as empty
+	if(!read_header_field(p, &num_hot_pages, HEADER_NUM_HOT_PAGES_SIZE, HEADER_NUM_HOT_PAGES_OFFSET)) num_hot_pages = 0;
+	if(num_hot_pages > TABLE_MAX_PAGES) num_hot_pages = TABLE_MAX_PAGES;
+	if(!read_header_field(p, page_nums, num_hot_pages * HEADER_HOT_PAGE_SIZE, HEADER_HOT_PAGES_OFFSET)) num_hot_pages = 0;
+	for(uint32_t i = 0; i<num_hot_pages; i++)
+	{
+		if(page_nums[i] != HEADER_PAGE_NUM && page_nums[i] < p->num_pages) page_nums[count++] = page_nums[i];
+	}
+	qsort(page_nums, count, sizeof(uint32_t), compare_page_nums);
+	for(uint32_t i = 0; i<count; i++)
+	{
+		if(p->compressed) posix_fadvise(p->file_descriptor, p->page_map[page_nums[i]].offset, p->page_map[page_nums[i]].length, POSIX_FADV_WILLNEED);
+		else posix_fadvise(p->file_descriptor, page_offset(p, page_nums[i]), p->page_size, POSIX_FADV_WILLNEED);
+	}
+	pager_load_pages(p, page_nums, count);
+	/*
+		then every internal node, one level of the tree at a time; all leaves are at the same depth, so the
+		leftmost path tells how many levels hold internal nodes
+	*/
+	uint32_t leaf_depth = 0;
+	for(void * node = get_page(p, t->root_page_num); get_node_type(node) == NODE_INTERNAL && leaf_depth < TABLE_MAX_PAGES; leaf_depth++)
+	{
+		node = get_page(p, *internal_node_child(node, 0));
+	}
+	uint32_t level[TABLE_MAX_PAGES], next_level[TABLE_MAX_PAGES], level_count = 1;
+	level[0] = t->root_page_num;
+	for(uint32_t depth = 0; depth+1 < leaf_depth; depth++)
+	{
+		uint32_t next_count = 0;
+		for(uint32_t i = 0; i<level_count; i++)
+		{
+			// the child pointers come from the file, warming skips the ones that cannot be pages of it
+			void * node = get_page(p, level[i]);
+			if(get_node_type(node) != NODE_INTERNAL) continue;
+			uint32_t num_keys = *internal_node_num_keys(node);
+			if(num_keys > p->internal_node_max_cells) continue;
+			for(uint32_t j = 0; j<=num_keys && next_count < TABLE_MAX_PAGES; j++)
+			{
+				uint32_t child = *internal_node_child(node, j);
+				if(child != HEADER_PAGE_NUM && child < p->num_pages) next_level[next_count++] = child;
+			}
+		}
+		qsort(next_level, next_count, sizeof(uint32_t), compare_page_nums);
+		pager_load_pages(p, next_level, next_count);
+		memcpy(level, next_level, next_count * sizeof(uint32_t));
+		level_count = next_count;
+	}
+}
+
+static bool pager_flush_compressed(pager * p, uint32_t page_num)
+{
+	uint8_t * packed = malloc(max_packed_size(p->page_size));
+	uint32_t length = pack_page(p, p->pages[page_num], packed);
+	pageExtent * extent = &(p->page_map[page_num]);
+	if(length > extent->capacity)
+	{
+		// the page outgrew its extent, free it first so the page can also grow into the space after it
+		if(extent->capacity > 0) extent_release(p, extent->offset, extent->capacity);
+		extent->capacity = (length + PAGE_EXTENT_ALIGN - 1) / PAGE_EXTENT_ALIGN * PAGE_EXTENT_ALIGN;
+		extent->offset = extent_allocate(p, extent->capacity);
+	}
+	extent->length = length;
+	ssize_t bytes_written = pwrite(p->file_descriptor, packed, length, extent->offset);
+	free(packed);
+	if(bytes_written == -1)
+	{
+		pager_fail(p, errno);
+		return false;
+	}
+	statementTrace * trace = pager_trace(p);
+	if(trace) trace->bytes_written += bytes_written;
+	return true;
+}
+
+static bool pager_flush(pager * p, uint32_t page_num)
+{
+	if(p->compressed) return pager_flush_compressed(p, page_num);
+	ssize_t bytes_written = pwrite(p->file_descriptor, p->pages[page_num], p->page_size, page_offset(p, page_num));
+	if(bytes_written == -1)
+	{
+		pager_fail(p, errno);
+		return false;
+	}
+	statementTrace * trace = pager_trace(p);
+	if(trace) trace->bytes_written += bytes_written;
+	return true;
+}
+
+static void * build_header(pager * p, uint32_t root_page_num, uint32_t num_pages)
+{
+	// the header is written as a whole page so the tree pages stay page aligned
+	void * header = calloc(1, p->page_size);
+	*(uint32_t *)(header + HEADER_MAGIC_OFFSET) = DB_FILE_MAGIC;
+	*(uint32_t *)(header + HEADER_VERSION_OFFSET) = p->compressed ? DB_FILE_VERSION_COMPRESSED : DB_FILE_VERSION;
+	*(uint32_t *)(header + HEADER_PAGE_SIZE_OFFSET) = p->page_size;
+	*(uint32_t *)(header + HEADER_ROOT_PAGE_OFFSET) = root_page_num;
+	*(uint32_t *)(header + HEADER_NUM_PAGES_OFFSET) = num_pages;
+	return header;
+}
+
+static bool pager_flush_header(pager * p, uint32_t root_page_num, uint64_t lsn)
+{
+	void * header = build_header(p, root_page_num, p->num_pages);
+	*(uint64_t *)(header + HEADER_LSN_OFFSET) = lsn;
+	// remember which pages are cached so the next open can warm the cache with them, as many as fit before the page map
+	uint32_t map_size = p->compressed ? p->num_pages * PAGE_MAP_ENTRY_SIZE : 0;
+	uint32_t max_hot_pages = (p->page_size - HEADER_SIZE - map_size) / HEADER_HOT_PAGE_SIZE, num_hot_pages = 0;
+	for(uint32_t i = 0; i<p->num_pages && num_hot_pages < max_hot_pages; i++)
+	{
+		if(p->pages[i] == NULL) continue;
+		*(uint32_t *)(header + HEADER_HOT_PAGES_OFFSET + num_hot_pages * HEADER_HOT_PAGE_SIZE) = i;
+		num_hot_pages++;
+	}
+	*(uint32_t *)(header + HEADER_NUM_HOT_PAGES_OFFSET) = num_hot_pages;
+	if(p->compressed) write_page_map(header, p->page_map);
+	ssize_t bytes_written = pwrite(p->file_descriptor, header, p->page_size, page_offset(p, HEADER_PAGE_NUM));
+	free(header);
+	if(bytes_written == -1)
+	{
+		pager_fail(p, errno);
+		return false;
+	}
+	return true;
+}
+
+static bool backup_copy_range(int source_fd, int destination_fd, off_t offset, size_t length)
+{
+	// pages not in the cache are unchanged since they were read from the db file, copy them inside the kernel
+	off_t offset_in = offset, offset_out = offset;
+	while(length > 0)
+	{
+		ssize_t copied = copy_file_range(source_fd, &offset_in, destination_fd, &offset_out, length, 0);
+		if(copied <= 0) break;
+		length -= copied;
+	}
+	if(length == 0) return true;
+	// copy_file_range is not supported between these files, fall back to large reads and writes
+	char * buffer = malloc(length);
+	ssize_t bytes_read = pread(source_fd, buffer, length, offset_in);
+	bool ok = bytes_read == length && pwrite(destination_fd, buffer, length, offset_out) == length;
+	free(buffer);
+	return ok;
+}
+
+static void backup_copy_pages(backup * b)
+{
+	snapshot * s = b->s;
+	pager * p = s->t->p;
+	void * header = build_header(p, s->root_page_num, s->num_pages);
+	b->failed = pwrite(b->file_descriptor, header, p->page_size, page_offset(p, HEADER_PAGE_NUM)) != p->page_size;
+	free(header);
+	void * batch = malloc(BACKUP_BATCH_PAGES * p->page_size);
+	uint32_t page_num = HEADER_PAGE_NUM+1;
+	while(!(b->failed) && page_num < s->num_pages)
+	{
+		/*
+			split the pages into runs, pages only on disk are copied straight from the db file, pages in the cache
+			may differ from the file and are copied from the snapshot into a batch written with a single write
+		*/
+		pthread_mutex_lock(&(p->lock));
+		bool on_disk = p->pages[page_num] == NULL && p->page_versions[page_num] == NULL;
+		pthread_mutex_unlock(&(p->lock));
+		uint32_t run_start = page_num, run_length = 0;
+		while(page_num < s->num_pages && run_length < BACKUP_BATCH_PAGES)
+		{
+			pthread_mutex_lock(&(p->lock));
+			bool page_on_disk = p->pages[page_num] == NULL && p->page_versions[page_num] == NULL;
+			if(page_on_disk == on_disk && !on_disk) memcpy(batch + run_length * p->page_size, snapshot_load_page(s, page_num), p->page_size);
+			pthread_mutex_unlock(&(p->lock));
+			if(page_on_disk != on_disk) break;
+			page_num++;
+			run_length++;
+		}
+		off_t offset = page_offset(p, run_start);
+		size_t length = (size_t)run_length * p->page_size;
+		if(on_disk) b->failed = !backup_copy_range(p->file_descriptor, b->file_descriptor, offset, length);
+		else b->failed = pwrite(b->file_descriptor, batch, length, offset) != length;
+		if(!(b->failed)) b->pages_copied += run_length;
+	}
+	free(batch);
+}
+
+static void backup_copy_compressed_pages(backup * b)
+{
+	/*
+		the copy is packed tightly after its header, pages only on disk are copied as they are stored without
+		decompressing them, cached pages are compressed from the snapshot; the header with the new page map goes last
+	*/
+	snapshot * s = b->s;
+	pager * p = s->t->p;
+	pageExtent page_map[TABLE_MAX_PAGES];
+	memset(page_map, 0, sizeof(page_map));
+	uint32_t batch_capacity = BACKUP_BATCH_PAGES * p->page_size, batch_length = 0;
+	uint8_t * batch = malloc(batch_capacity);
+	void * page = malloc(p->page_size);
+	uint64_t batch_offset = p->page_size;
+	for(uint32_t page_num = HEADER_PAGE_NUM+1; !(b->failed) && page_num < s->num_pages; page_num++)
+	{
+		if(batch_length + max_packed_size(p->page_size) > batch_capacity)
+		{
+			b->failed = pwrite(b->file_descriptor, batch, batch_length, batch_offset) != batch_length;
+			batch_offset += batch_length;
+			batch_length = 0;
+		}
+		pthread_mutex_lock(&(p->lock));
+		bool on_disk = p->pages[page_num] == NULL && p->page_versions[page_num] == NULL;
+		pageExtent extent = p->page_map[page_num];
+		if(!on_disk) memcpy(page, snapshot_load_page(s, page_num), p->page_size);
+		pthread_mutex_unlock(&(p->lock));
+		uint32_t length;
+		if(!on_disk) length = pack_page(p, page, batch + batch_length);
+		else
+		{
+			length = extent.length;
+			if(pread(p->file_descriptor, batch + batch_length, length, extent.offset) != length) b->failed = true;
+		}
+		page_map[page_num].offset = batch_offset + batch_length;
+		page_map[page_num].length = length;
+		page_map[page_num].capacity = length;
+		batch_length += length;
+		if(!(b->failed)) b->pages_copied++;
+	}
+	if(!(b->failed) && batch_length > 0) b->failed = pwrite(b->file_descriptor, batch, batch_length, batch_offset) != batch_length;
+	free(page);
+	free(batch);
+	if(b->failed) return;
+	void * header = build_header(p, s->root_page_num, s->num_pages);
+	write_page_map(header, page_map);
+	b->failed = pwrite(b->file_descriptor, header, p->page_size, page_offset(p, HEADER_PAGE_NUM)) != p->page_size;
+	free(header);
+}
+
+static void * backup_run(void * arg)
+{
+	backup * b = arg;
+	snapshot * s = b->s;
+	pager * p = s->t->p;
+	if(p->compressed) backup_copy_compressed_pages(b);
+	else backup_copy_pages(b);
+	if(fsync(b->file_descriptor) == -1) b->failed = true;
+	close(b->file_descriptor);
+	snapshot_close(s);
+	pthread_mutex_lock(&(p->lock));
+	b->done = true;
+	pthread_mutex_unlock(&(p->lock));
+	return NULL;
+}
+
+static void memtable_merge(table * t);
+
+bool backup_start(table * t, const char * path)
+{
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, S_IWUSR|S_IRUSR);
+	if(fd == -1) return false;
+	backup * b = malloc(sizeof(backup));
+	b->path = strdup(path);
+	b->file_descriptor = fd;
+	b->done = false;
+	b->failed = false;
+	b->pages_copied = 1; // the header
+	pthread_mutex_lock(&(t->write_lock));
+	// buffered rows are not in the tree yet, the snapshot would miss them
+	if(t->buffer) memtable_merge(t);
+	b->s = snapshot_open(t);
+	pthread_mutex_unlock(&(t->write_lock));
+	t->running_backup = b;
+	pthread_create(&(b->thread), NULL, backup_run, b);
+	return true;
+}
+
+bool backup_running(table * t)
+{
+	return t->running_backup != NULL;
+}
+
+backup * backup_finish(table * t)
+{
+	backup * b = t->running_backup;
+	if(b == NULL) return NULL;
+	pthread_join(b->thread, NULL);
+	t->running_backup = NULL;
+	return b;
+}
+
+backup * backup_poll(table * t)
+{
+	if(t->running_backup == NULL) return NULL;
+	pthread_mutex_lock(&(t->p->lock));
+	bool done = t->running_backup->done;
+	pthread_mutex_unlock(&(t->p->lock));
+	if(done) return backup_finish(t);
+	return NULL;
+}
+
+const char * backup_path(backup * b)
+{
+	return b->path;
+}
+
+bool backup_failed(backup * b)
+{
+	return b->failed;
+}
+
+uint32_t backup_pages_copied(backup * b)
+{
+	return b->pages_copied;
+}
+
+void backup_free(backup * b)
+{
+	free(b->path);
+	free(b);
+}
+
+static void replica_stop(table * t);
+
+bool db_close(table * t)
+{
+	// the backup copies unchanged pages from the db file, finish it before the file is written
+	if(t->running_backup) backup_free(backup_finish(t));
+	if(t->source) replica_stop(t);
+	if(t->replication_log != -1) close(t->replication_log);
+	if(t->buffer)
+	{
+		memtable_merge(t);
+		free(t->buffer->nodes);
+		free(t->buffer->key_filter);
+		free(t->buffer);
+	}
+	pager * p = t->p;
+	// after a failed read the cache may hold a tree that was only partly changed, leave the file as it was
+	bool written = p->error == 0;
+	// uint32_t num_full_pages = t->num_rows/ROWS_PER_PAGE;
+	for(uint32_t i = 0; written && i<p->num_pages; i++)
+	{
+		if(p->pages[i] == NULL) continue;	
+		written = pager_flush(p, i);
+	}
+	// the header goes last, it records where compressed pages were written and which pages are still cached
+	if(written) written = pager_flush_header(p, t->root_page_num, t->lsn);
+	// free extents at the end of the file were given back to file_end, cut them off
+	if(written && p->compressed && ftruncate(p->file_descriptor, p->file_end) == -1) written = false;
+	if(close(p->file_descriptor) == -1) written = false;
+	pthread_mutex_destroy(&(p->lock));
+	for(uint32_t i = 0; i<TABLE_MAX_PAGES; i++)	
+	{
+		void * page = p->pages[i];
+		if(page)
+		{
+			free(page);	
+			p->pages[i] = NULL;
+		}
+		while(p->page_versions[i])
+		{
+			pageVersion * version = p->page_versions[i];
+			p->page_versions[i] = version->next;
+			free(version->data);
+			free(version);
+		}
+	}
+	while(t->snapshots)
+	{
+		snapshot * s = t->snapshots;
+		t->snapshots = s->next;
+		free(s);
+	}
+	free(t->hash_index);
+	pthread_mutex_destroy(&(t->write_lock));
+	free(p->failed_page);
+	free(p);
+	free(t);
+	return written;
+}
+
+int db_error(table * t)
+{
+	return pager_error(t->p);
+}
+
+static void leaf_node_split_and_insert(cursor * c, uint32_t key, row * value)
+{
+	/*
+		create a new node and move half the cells over
+		insert the new value in one of the two nodes
+		update parent or create a new parent
+	*/
+	statementTrace * trace = pager_trace(c->t->p);
+	if(trace) trace->leaf_splits++;
+	void * old_node = get_page_for_write(c->t->p, c->page_num);
+	uint32_t old_max = get_node_max_key(c->t->p, old_node);	
+	uint32_t new_page_num = get_unused_page_num(c->t->p);
+	void * new_node = get_page_for_write(c->t->p, new_page_num);
+	initialize_leaf_node(new_node);
+	*node_parent(new_node) = *node_parent(old_node);
+	*leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+	*leaf_node_next_leaf(old_node) = new_page_num;
+	/*
+		all existing keys plus new key should be divided 
+		evenly between old(left) and new(right) nodes
+		starting from the right, move each key to correct position
+	*/
+	pager * p = c->t->p;
+	for(int32_t i = p->leaf_node_max_cells; i>=0; i--)
+	{
+		void * destination_node;
+		if(i >= p->leaf_node_left_split_count) destination_node = new_node;
+		else destination_node = old_node;
+		uint32_t index_within_node = i%p->leaf_node_left_split_count;
+		void * destination = leaf_node_cell(destination_node, index_within_node);
+		if(i == c->cell_num) 	
+		{
+			serialize_row(value, leaf_node_value(destination_node, index_within_node));
+			*leaf_node_key(destination_node, index_within_node) = key;
+		}
+		else if(i > c->cell_num) memcpy(destination, leaf_node_cell(old_node, i-1), LEAF_NODE_CELL_SIZE);
+		else memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);  
+	}
+	// update cell count on both leaf sides
+	*(leaf_node_num_cells(old_node)) = p->leaf_node_left_split_count;
+	*(leaf_node_num_cells(new_node)) = p->leaf_node_right_split_count;
+	if(is_node_root(old_node)) return create_new_root(c->t, new_page_num);
+	else 
+	{
+		uint32_t parent_page_num = *node_parent(old_node);
+		uint32_t new_max = get_node_max_key(c->t->p, old_node);
+		void * parent = get_page_for_write(c->t->p, parent_page_num);
+		update_internal_node_key(parent, old_max, new_max);
+		internal_node_insert(c->t, parent_page_num, new_page_num);
+		return;
+	}
+}
+
+static void leaf_node_insert(cursor * c, uint32_t key, row * value)
+{
+	void * node = get_page_for_write(c->t->p, c->page_num);
+	uint32_t num_cells = *leaf_node_num_cells(node);
+	if(num_cells >= c->t->p->leaf_node_max_cells)	
+	{
+		// node full
+		leaf_node_split_and_insert(c, key, value);
+		return;
+	}
+	if(c->cell_num < num_cells)
+	{
+		// make room for new cell
+		for(uint32_t i = num_cells; i>c->cell_num; i--) memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i-1), LEAF_NODE_CELL_SIZE);
+	}
+	*(leaf_node_num_cells(node)) += 1;
+	*(leaf_node_key(node, c->cell_num)) = key;
+	serialize_row(value, leaf_node_value(node, c->cell_num));
+}
+
+static uint32_t key_filter_hash(uint32_t id, uint32_t seed)
+{
+	// murmur3 finalizer
+	uint32_t h = id ^ seed;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static bool key_filter_probe(memtable * m, uint32_t id, bool add)
+{
+	// the bits of an id are picked by double hashing, true when all of them were set already
+	uint32_t h1 = key_filter_hash(id, 0), h2 = key_filter_hash(id, 0x9e3779b9) | 1;
+	bool present = true;
+	for(uint32_t i = 0; i<KEY_FILTER_HASHES; i++)
+	{
+		uint32_t bit = (h1 + i * h2) % m->key_filter_bits;
+		if(!(m->key_filter[bit / 8] & (1 << (bit % 8)))) present = false;
+		if(add) m->key_filter[bit / 8] |= 1 << (bit % 8);
+	}
+	return present;
+}
+
+static void memtable_reset(memtable * m)
+{
+	m->num_rows = 0;
+	m->height = 1;
+	for(uint32_t level = 0; level<MEMTABLE_MAX_HEIGHT; level++) m->nodes[0].next[level] = 0;
+}
+
+void table_enable_memtable(table * t, uint32_t threshold)
+{
+	memtable * m = malloc(sizeof(memtable));
+	// node 0 of the arena is the head of the skiplist, each row takes the next free node
+	m->nodes = malloc((threshold+1) * sizeof(memtableNode));
+	m->threshold = threshold;
+	m->random_state = 0x2545f491;
+	memtable_reset(m);
+	// sized for the most ids the tree can hold, filled with the ids already in it
+	m->key_filter_bits = TABLE_MAX_PAGES * t->p->leaf_node_max_cells * KEY_FILTER_BITS_PER_KEY;
+	m->key_filter = calloc(m->key_filter_bits / 8 + 1, 1);
+	cursor * c = table_start(t);
+	uint32_t page_num = c->page_num;
+	free(c);
+	while(true)
+	{
+		void * node = get_page(t->p, page_num);
+		for(uint32_t i = 0; i<*leaf_node_num_cells(node); i++) key_filter_probe(m, *leaf_node_key(node, i), true);
+		page_num = *leaf_node_next_leaf(node);
+		if(page_num == 0) break;
+	}
+	t->buffer = m;
+}
+
+static uint32_t memtable_random_height(memtable * m)
+{
+	// xorshift, every level links about a quarter of the nodes of the level below
+	uint32_t height = 1;
+	while(height < MEMTABLE_MAX_HEIGHT)
+	{
+		m->random_state ^= m->random_state << 13;
+		m->random_state ^= m->random_state >> 17;
+		m->random_state ^= m->random_state << 5;
+		if(m->random_state & 3) break;
+		height++;
+	}
+	return height;
+}
+
+/*
+	return the node holding the given id, or 0 if it is not buffered;
+	update, when given, gets the last node before the id on every level
+*/
+static uint32_t memtable_find(memtable * m, uint32_t id, uint32_t * update)
+{
+	uint32_t node = 0;
+	for(int32_t level = m->height-1; level >= 0; level--)
+	{
+		while(m->nodes[node].next[level] != 0 && m->nodes[m->nodes[node].next[level]].r.id < id) node = m->nodes[node].next[level];
+		if(update) update[level] = node;
+	}
+	uint32_t next = m->nodes[node].next[0];
+	return next != 0 && m->nodes[next].r.id == id ? next : 0;
+}
+
+static row * memtable_get(memtable * m, uint32_t id)
+{
+	uint32_t node = memtable_find(m, id, NULL);
+	return node ? &(m->nodes[node].r) : NULL;
+}
+
+static void memtable_insert(memtable * m, row * r)
+{
+	uint32_t update[MEMTABLE_MAX_HEIGHT];
+	memtable_find(m, r->id, update);
+	uint32_t height = memtable_random_height(m);
+	for(; m->height < height; m->height++) update[m->height] = 0;
+	uint32_t node = ++(m->num_rows);
+	memcpy(&(m->nodes[node].r), r, sizeof(row));
+	for(uint32_t level = 0; level<height; level++)
+	{
+		m->nodes[node].next[level] = m->nodes[update[level]].next[level];
+		m->nodes[update[level]].next[level] = node;
+	}
+}
+
+static bool table_has_room_for_splits(table * t, uint32_t leaf_splits)
+{
+	/*
+		every leaf split takes a new page, the internal nodes above them one more per level in the worst case
+		and a new root one more; an internal node has room for more children than a merge adds
+	*/
+	uint32_t depth = 1;
+	for(void * node = get_page(t->p, t->root_page_num); get_node_type(node) == NODE_INTERNAL; depth++)
+	{
+		node = get_page(t->p, *internal_node_child(node, 0));
+	}
+	return t->p->num_pages + leaf_splits + depth <= pager_max_pages(t->p);
+}
+
+static void memtable_merge(table * t)
+{
+	/*
+		insert the buffered rows in key order, a row that belongs to the leaf the previous row went into
+		is placed with a search inside that leaf instead of a new descent from the root; rows whose leaf
+		would have to split when the tree has no pages left stay buffered
+	*/
+	memtable * m = t->buffer;
+	cursor * c = NULL;
+	row * left_over = NULL;
+	uint32_t num_left_over = 0;
+	for(uint32_t node = m->nodes[0].next[0]; node != 0; node = m->nodes[node].next[0])
+	{
+		row * r = &(m->nodes[node].r);
+		key_filter_probe(m, r->id, true);
+		if(c)
+		{
+			void * node = get_page(t->p, c->page_num);
+			uint32_t num_cells = *leaf_node_num_cells(node);
+			bool in_leaf = *leaf_node_next_leaf(node) == 0 || (num_cells > 0 && r->id <= *leaf_node_key(node, num_cells-1));
+			uint32_t page_num = c->page_num;
+			free(c);
+			c = NULL;
+			if(in_leaf && num_cells < t->p->leaf_node_max_cells) c = leaf_node_find(t, NULL, page_num, r->id);
+		}
+		if(c == NULL) c = table_find(t, r->id);
+		void * node = get_page(t->p, c->page_num);
+		bool splits = *leaf_node_num_cells(node) >= t->p->leaf_node_max_cells;
+		if(splits && !table_has_room_for_splits(t, 1))
+		{
+			// the rows after it may still fit their leaves
+			if(left_over == NULL) left_over = malloc(m->num_rows * sizeof(row));
+			memcpy(&(left_over[num_left_over++]), r, sizeof(row));
+			free(c);
+			c = NULL;
+			continue;
+		}
+		leaf_node_insert(c, r->id, r);
+		// a split moves cells to another leaf, look the next row up from the root
+		if(splits)
+		{
+			free(c);
+			c = NULL;
+		}
+	}
+	free(c);
+	memtable_reset(m);
+	for(uint32_t i = 0; i<num_left_over; i++) memtable_insert(m, &(left_over[i]));
+	free(left_over);
+}
+
+static bool cursor_at_key(cursor * c, uint32_t key)
+{
+	void * node = read_page(c->t, c->s, c->page_num);
+	return c->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, c->cell_num) == key;
+}
+
+static executeResult table_error_result(table * t)
+{
+	// EXECUTE_SUCCESS until a read or write of the db file fails
+	return pager_error(t->p) == 0 ? EXECUTE_SUCCESS : EXECUTE_IO_ERROR;
+}
+
+static executeResult table_insert(table * t, row * row_to_insert)
+{
+	// the tree may be half changed after a failed read, nothing is inserted into it from then on
+	executeResult result = table_error_result(t);
+	if(result != EXECUTE_SUCCESS) return result;
+	uint32_t id = row_to_insert->id;
+	memtable * m = t->buffer;
+	if(m)
+	{
+		/*
+			the row waits in the memtable, the tree is only written when the memtable is merged; it is only
+			searched for a duplicate when the key filter says the id may be in it, so a new id skips the descent
+		*/
+		if(memtable_get(m, id)) return EXECUTE_DUPLICATE_KEY;
+		if(key_filter_probe(m, id, false))
+		{
+			cursor * c = table_find(t, id);
+			bool duplicate = cursor_at_key(c, id);
+			free(c);
+			if(duplicate) return EXECUTE_DUPLICATE_KEY;
+		}
+		// a buffered row is only acknowledged while the tree has room for every buffered row to split its leaf
+		if(m->num_rows + 1 < m->threshold && table_has_room_for_splits(t, m->num_rows + 1))
+		{
+			memtable_insert(m, row_to_insert);
+			return EXECUTE_SUCCESS;
+		}
+		// otherwise the row goes straight into the tree after the merge, so a full tree refuses it
+		memtable_merge(t);
+		result = table_error_result(t);
+		if(result != EXECUTE_SUCCESS) return result;
+		key_filter_probe(m, id, true);
+	}
+	cursor * c = table_find(t, id);
+	result = table_error_result(t);
+	if(result == EXECUTE_SUCCESS && cursor_at_key(c, id)) result = EXECUTE_DUPLICATE_KEY;
+	bool splits = *leaf_node_num_cells(get_page(t->p, c->page_num)) >= t->p->leaf_node_max_cells;
+	if(result == EXECUTE_SUCCESS && splits && !table_has_room_for_splits(t, 1)) result = EXECUTE_TABLE_FULL;
+	if(result == EXECUTE_SUCCESS)
+	{
+		leaf_node_insert(c, id, row_to_insert);
+		result = table_error_result(t);
+	}
+	free(c);
+	return result;
+}
+
+static bool replication_log_append(table * t, row * r);
+
+executeResult db_insert(table * t, uint32_t id, const char * username, const char * email)
+{
+	if(t->source) return EXECUTE_READ_ONLY;
+	if(strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) return EXECUTE_STRING_TOO_LONG;
+	row row_to_insert;
+	// the whole column is written to the page, keep the unused bytes zeroed
+	memset(&row_to_insert, 0, sizeof(row));
+	row_to_insert.id = id;
+	strcpy(row_to_insert.username, username);
+	strcpy(row_to_insert.email, email);
+	pthread_mutex_lock(&(t->write_lock));
+	executeResult result = table_insert(t, &row_to_insert);
+	if(result == EXECUTE_SUCCESS && t->replication_log != -1 && !replication_log_append(t, &row_to_insert)) result = EXECUTE_IO_ERROR;
+	pthread_mutex_unlock(&(t->write_lock));
+	return result;
+}
+
+const void * db_get(table * t, uint32_t id)
+{
+	if(t->buffer)
+	{
+		// a row struct has the same layout as its serialized form
+		row * buffered = memtable_get(t->buffer, id);
+		if(buffered) return buffered;
+	}
+	hashIndexEntry * entry = &(t->hash_index[(id * 2654435761u) >> (32 - HASH_INDEX_BITS)]);
+	if(entry->lookups > 0 && entry->id == id && entry->page_num != INVALID_PAGE_NUM && t->p->page_write_count[entry->page_num] == entry->page_write_count)
+	{
+		statementTrace * trace = pager_trace(t->p);
+		if(trace) trace->hash_index_hits++;
+		if(entry->lookups < HASH_INDEX_MAX_LOOKUPS) entry->lookups++;
+		return leaf_node_value(get_page(t->p, entry->page_num), entry->cell_num);
+	}
+	cursor * c = table_find(t, id);
+	void * node = get_page(t->p, c->page_num);
+	const void * value = NULL;
+	if(c->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, c->cell_num) == id) value = leaf_node_value(node, c->cell_num);
+	// another id only takes the slot once the lookups of the one holding it have worn off
+	if(entry->lookups > 0 && entry->id != id) entry->lookups--;
+	else
+	{
+		if(entry->lookups == 0) entry->id = id;
+		if(entry->lookups < HASH_INDEX_MAX_LOOKUPS) entry->lookups++;
+		entry->page_num = INVALID_PAGE_NUM;
+		if(value && entry->lookups >= HASH_INDEX_PROMOTE_LOOKUPS)
+		{
+			entry->page_num = c->page_num;
+			entry->cell_num = c->cell_num;
+			entry->page_write_count = t->p->page_write_count[c->page_num];
+		}
+	}
+	free(c);
+	return value;
+}
+
+static tableCursor * cursor_open(table * t, bool reverse)
+{
+	tableCursor * tc = malloc(sizeof(tableCursor));
+	pthread_mutex_lock(&(t->write_lock));
+	tc->s = snapshot_open(t);
+	// the memtable changes with every insert, keep a copy of its rows so the cursor sees one version
+	tc->num_buffered = t->buffer ? t->buffer->num_rows : 0;
+	tc->buffered = malloc(tc->num_buffered * sizeof(row));
+	uint32_t i = 0;
+	for(uint32_t node = t->buffer ? t->buffer->nodes[0].next[0] : 0; node != 0; node = t->buffer->nodes[node].next[0])
+	{
+		memcpy(&(tc->buffered[i++]), &(t->buffer->nodes[node].r), sizeof(row));
+	}
+	pthread_mutex_unlock(&(t->write_lock));
+	tc->c = reverse ? snapshot_end(tc->s) : snapshot_start(tc->s);
+	tc->next_buffered = 0;
+	tc->reverse = reverse;
+	return tc;
+}
+
+tableCursor * db_cursor_open(table * t)
+{
+	return cursor_open(t, false);
+}
+
+tableCursor * db_cursor_open_reverse(table * t)
+{
+	return cursor_open(t, true);
+}
+
+static row * db_cursor_buffered(tableCursor * tc)
+{
+	if(tc->next_buffered >= tc->num_buffered) return NULL;
+	if(tc->reverse) return &(tc->buffered[tc->num_buffered-1-tc->next_buffered]);
+	return &(tc->buffered[tc->next_buffered]);
+}
+
+static bool db_cursor_on_buffered(tableCursor * tc)
+{
+	// buffered rows are merged into the tree rows in id order
+	row * buffered = db_cursor_buffered(tc);
+	if(buffered == NULL) return false;
+	if(tc->c->end_of_table) return true;
+	uint32_t tree_id = db_row_id(cursor_value(tc->c));
+	return tc->reverse ? buffered->id > tree_id : buffered->id < tree_id;
+}
+
+const void * db_cursor_row(tableCursor * tc)
+{
+	if(db_cursor_on_buffered(tc)) return db_cursor_buffered(tc);
+	if(tc->c->end_of_table) return NULL;
+	return cursor_value(tc->c);
+}
+
+void db_cursor_next(tableCursor * tc)
+{
+	if(db_cursor_on_buffered(tc)) tc->next_buffered++;
+	else if(tc->c->end_of_table) return;
+	else if(tc->reverse) cursor_retreat(tc->c);
+	else cursor_advance(tc->c);
+}
+
+void db_cursor_close(tableCursor * tc)
+{
+	free(tc->c);
+	snapshot_close(tc->s);
+	free(tc->buffered);
+	free(tc);
+}
+
+uint32_t db_row_id(const void * value)
+{
+	return *(uint32_t *)(value + ID_OFFSET);
+}
+
+const char * db_row_username(const void * value)
+{
+	return value + USERNAME_OFFSET;
+}
+
+const char * db_row_email(const void * value)
+{
+	return value + EMAIL_OFFSET;
+}
+
+void db_trace_begin(table * t, statementTrace * trace)
+{
+	// a replica thread checks the trace while it holds the write lock, a backup thread while it holds the pager lock
+	memset(trace, 0, sizeof(statementTrace));
+	pthread_mutex_lock(&(t->write_lock));
+	pthread_mutex_lock(&(t->p->lock));
+	t->p->trace = trace;
+	t->p->trace_thread = pthread_self();
+	pthread_mutex_unlock(&(t->p->lock));
+	pthread_mutex_unlock(&(t->write_lock));
+}
+
+void db_trace_end(table * t)
+{
+	pthread_mutex_lock(&(t->write_lock));
+	pthread_mutex_lock(&(t->p->lock));
+	t->p->trace = NULL;
+	pthread_mutex_unlock(&(t->p->lock));
+	pthread_mutex_unlock(&(t->write_lock));
+}
+
+typedef struct
+{
+	int file_descriptor;
+	bool failed;
+	uint64_t num_rows;
+	uint32_t num_groups;
+	// the row group being gathered, columnar format
+	uint32_t group_rows;
+	uint32_t * ids;
+	uint32_t * username_offsets;
+	char * usernames;
+	uint32_t * email_offsets;
+	char * emails;
+	// csv format
+	char * text;
+	uint32_t text_length;
+}exporter;
+
+static void export_write_group(exporter * e)
+{
+	if(e->group_rows == 0 || e->failed) return;
+	uint32_t n = e->group_rows;
+	uint32_t group_header[3] = {n, e->username_offsets[n], e->email_offsets[n]};
+	struct iovec iov[6] = {
+		{group_header, sizeof(group_header)},
+		{e->ids, n * sizeof(uint32_t)},
+		{e->username_offsets, (n+1) * sizeof(uint32_t)},
+		{e->usernames, e->username_offsets[n]},
+		{e->email_offsets, (n+1) * sizeof(uint32_t)},
+		{e->emails, e->email_offsets[n]}
+	};
+	size_t length = 0;
+	for(uint32_t i = 0; i<6; i++) length += iov[i].iov_len;
+	e->failed = writev(e->file_descriptor, iov, 6) != length;
+	e->num_groups++;
+	e->group_rows = 0;
+}
+
+static void export_gather(exporter * e, void * node, uint32_t first, uint32_t count)
+{
+	// pull the columns straight out of the leaf cells, no row is deserialized
+	uint32_t n = e->group_rows;
+	uint32_t * ids = e->ids + n;
+	for(uint32_t i = 0; i<count; i++) ids[i] = *leaf_node_key(node, first+i);
+	for(uint32_t i = 0; i<count; i++)
+	{
+		const char * value = leaf_node_value(node, first+i);
+		uint32_t username_length = strnlen(value + USERNAME_OFFSET, COLUMN_USERNAME_SIZE);
+		uint32_t email_length = strnlen(value + EMAIL_OFFSET, COLUMN_EMAIL_SIZE);
+		memcpy(e->usernames + e->username_offsets[n+i], value + USERNAME_OFFSET, username_length);
+		memcpy(e->emails + e->email_offsets[n+i], value + EMAIL_OFFSET, email_length);
+		e->username_offsets[n+i+1] = e->username_offsets[n+i] + username_length;
+		e->email_offsets[n+i+1] = e->email_offsets[n+i] + email_length;
+	}
+	e->group_rows += count;
+}
+
+static void export_flush_text(exporter * e)
+{
+	if(e->text_length == 0 || e->failed) return;
+	e->failed = write(e->file_descriptor, e->text, e->text_length) != e->text_length;
+	e->text_length = 0;
+}
+
+static void export_csv_field(exporter * e, const char * value, uint32_t length)
+{
+	// quote a field holding a separator or a quote, quotes inside are doubled
+	bool quoted = memchr(value, ',', length) || memchr(value, '"', length);
+	e->text[e->text_length++] = ',';
+	if(quoted) e->text[e->text_length++] = '"';
+	for(uint32_t i = 0; i<length; i++)
+	{
+		if(value[i] == '"') e->text[e->text_length++] = '"';
+		e->text[e->text_length++] = value[i];
+	}
+	if(quoted) e->text[e->text_length++] = '"';
+}
+
+static void export_csv_rows(exporter * e, void * node, uint32_t num_cells)
+{
+	// the longest line is an id, two fields with every byte a doubled quote, and separators
+	const uint32_t max_line = 10 + 2 * (COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE) + 8;
+	for(uint32_t i = 0; i<num_cells; i++)
+	{
+		if(e->text_length + max_line > EXPORT_TEXT_BUFFER) export_flush_text(e);
+		const char * value = leaf_node_value(node, i);
+		e->text_length += sprintf(e->text + e->text_length, "%u", *leaf_node_key(node, i));
+		export_csv_field(e, value + USERNAME_OFFSET, strnlen(value + USERNAME_OFFSET, COLUMN_USERNAME_SIZE));
+		export_csv_field(e, value + EMAIL_OFFSET, strnlen(value + EMAIL_OFFSET, COLUMN_EMAIL_SIZE));
+		e->text[e->text_length++] = '\n';
+	}
+}
+
+bool db_export(table * t, const char * path, exportFormat format, uint64_t * num_rows)
+{
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, S_IWUSR|S_IRUSR);
+	if(fd == -1) return false;
+	pthread_mutex_lock(&(t->write_lock));
+	// buffered rows are not in the leaves yet
+	if(t->buffer) memtable_merge(t);
+	snapshot * s = snapshot_open(t);
+	pthread_mutex_unlock(&(t->write_lock));
+	exporter e;
+	memset(&e, 0, sizeof(exporter));
+	e.file_descriptor = fd;
+	if(format == EXPORT_COLUMNAR)
+	{
+		e.ids = malloc(EXPORT_GROUP_ROWS * sizeof(uint32_t));
+		e.username_offsets = malloc((EXPORT_GROUP_ROWS+1) * sizeof(uint32_t));
+		e.usernames = malloc(EXPORT_GROUP_ROWS * COLUMN_USERNAME_SIZE);
+		e.email_offsets = malloc((EXPORT_GROUP_ROWS+1) * sizeof(uint32_t));
+		e.emails = malloc(EXPORT_GROUP_ROWS * COLUMN_EMAIL_SIZE);
+		e.username_offsets[0] = 0;
+		e.email_offsets[0] = 0;
+		// the header is rewritten with the counts once every group is out
+		uint8_t header[EXPORT_HEADER_SIZE];
+		memset(header, 0, EXPORT_HEADER_SIZE);
+		e.failed = write(fd, header, EXPORT_HEADER_SIZE) != EXPORT_HEADER_SIZE;
+	}
+	else e.text = malloc(EXPORT_TEXT_BUFFER);
+	// walk the leaf chain of the snapshot from the leftmost leaf
+	cursor * c = snapshot_start(s);
+	uint32_t page_num = c->page_num;
+	free(c);
+	while(!(e.failed))
+	{
+		void * node = read_page(t, s, page_num);
+		uint32_t num_cells = *leaf_node_num_cells(node);
+		if(format == EXPORT_CSV) export_csv_rows(&e, node, num_cells);
+		for(uint32_t first = 0; format == EXPORT_COLUMNAR && first < num_cells; )
+		{
+			uint32_t count = num_cells - first;
+			if(count > EXPORT_GROUP_ROWS - e.group_rows) count = EXPORT_GROUP_ROWS - e.group_rows;
+			export_gather(&e, node, first, count);
+			first += count;
+			if(e.group_rows == EXPORT_GROUP_ROWS) export_write_group(&e);
+		}
+		e.num_rows += num_cells;
+		page_num = *leaf_node_next_leaf(node);
+		if(page_num == 0) break;
+	}
+	if(format == EXPORT_COLUMNAR)
+	{
+		export_write_group(&e);
+		uint8_t header[EXPORT_HEADER_SIZE];
+		*(uint32_t *)(header + EXPORT_MAGIC_OFFSET) = EXPORT_MAGIC;
+		*(uint64_t *)(header + EXPORT_NUM_ROWS_OFFSET) = e.num_rows;
+		*(uint32_t *)(header + EXPORT_NUM_GROUPS_OFFSET) = e.num_groups;
+		if(!(e.failed)) e.failed = pwrite(fd, header, EXPORT_HEADER_SIZE, 0) != EXPORT_HEADER_SIZE;
+	}
+	else export_flush_text(&e);
+	snapshot_close(s);
+	free(e.ids);
+	free(e.username_offsets);
+	free(e.usernames);
+	free(e.email_offsets);
+	free(e.emails);
+	free(e.text);
+	if(close(fd) == -1) e.failed = true;
+	// leaves that could not be read were left out
+	if(db_error(t)) e.failed = true;
+	*num_rows = e.num_rows;
+	return !(e.failed);
+}
+
+static uint32_t log_record_size()
+{
+	return LOG_RECORD_ROW_OFFSET + ROW_SIZE;
+}
+
+static uint64_t log_num_records(int file_descriptor)
+{
+	// a record still being written at the end of the log is not counted
+	struct stat st;
+	if(fstat(file_descriptor, &st) == -1 || st.st_size < LOG_HEADER_SIZE) return 0;
+	return (st.st_size - LOG_HEADER_SIZE) / log_record_size();
+}
+
+static bool log_header_valid(int file_descriptor)
+{
+	uint32_t header[2];
+	if(pread(file_descriptor, header, LOG_HEADER_SIZE, 0) != LOG_HEADER_SIZE) return false;
+	return header[0] == LOG_MAGIC && header[1] == log_record_size();
+}
+
+bool db_enable_replication_log(table * t, const char * path)
+{
+	int fd = open(path, O_RDWR|O_CREAT|O_APPEND, S_IWUSR|S_IRUSR);
+	if(fd == -1) return false;
+	off_t length = lseek(fd, 0, SEEK_END);
+	if(length == 0)
+	{
+		uint32_t header[2] = {LOG_MAGIC, log_record_size()};
+		if(write(fd, header, LOG_HEADER_SIZE) != LOG_HEADER_SIZE)
+		{
+			close(fd);
+			return false;
+		}
+	}
+	else if(!log_header_valid(fd))
+	{
+		close(fd);
+		return false;
+	}
+	// drop a record cut short by a crash so the records appended from here stay aligned
+	uint64_t num_records = log_num_records(fd);
+	if(ftruncate(fd, LOG_HEADER_SIZE + num_records * log_record_size()) == -1)
+	{
+		close(fd);
+		return false;
+	}
+	t->lsn = num_records;
+	t->replication_log = fd;
+	return true;
+}
+
+static bool replication_log_append(table * t, row * r)
+{
+	uint8_t record[log_record_size()];
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	*(uint64_t *)(record + LOG_RECORD_LSN_OFFSET) = t->lsn + 1;
+	*(uint64_t *)(record + LOG_RECORD_TIME_OFFSET) = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	serialize_row(r, record + LOG_RECORD_ROW_OFFSET);
+	// replicas would miss the row, the table stops taking inserts like after a failed write of the db file
+	ssize_t bytes_written = write(t->replication_log, record, log_record_size());
+	if(bytes_written != log_record_size())
+	{
+		int error = bytes_written == -1 ? errno : EIO;
+		pthread_mutex_lock(&(t->p->lock));
+		pager_fail(t->p, error);
+		pthread_mutex_unlock(&(t->p->lock));
+		return false;
+	}
+	t->lsn++;
+	return true;
+}
+
+static void replica_apply(replica * r)
+{
+	// apply the records appended since the last poll, a batch at a time so snapshots and lookups get in between
+	table * t = r->t;
+	uint64_t num_records = log_num_records(r->file_descriptor);
+	uint8_t * batch = malloc(REPLICA_BATCH_RECORDS * log_record_size());
+	bool failed = false;
+	while(!failed && t->lsn < num_records)
+	{
+		uint64_t count = num_records - t->lsn;
+		if(count > REPLICA_BATCH_RECORDS) count = REPLICA_BATCH_RECORDS;
+		size_t length = count * log_record_size();
+		if(pread(r->file_descriptor, batch, length, LOG_HEADER_SIZE + t->lsn * log_record_size()) != length) break;
+		pthread_mutex_lock(&(r->lock));
+		pthread_mutex_lock(&(t->write_lock));
+		for(uint64_t i = 0; !failed && i<count; i++)
+		{
+			uint8_t * record = batch + i * log_record_size();
+			row row_to_insert;
+			memset(&row_to_insert, 0, sizeof(row));
+			deserialize_row(record + LOG_RECORD_ROW_OFFSET, &row_to_insert);
+			// a replica seeded from a backup may already hold the row, applying the log again is harmless
+			executeResult result = table_insert(t, &row_to_insert);
+			// once the db file fails the replica stops where it is, db_error tells why
+			failed = result == EXECUTE_IO_ERROR || result == EXECUTE_TABLE_FULL;
+			if(!failed) t->lsn = *(uint64_t *)(record + LOG_RECORD_LSN_OFFSET);
+		}
+		pthread_mutex_unlock(&(t->write_lock));
+		pthread_mutex_unlock(&(r->lock));
+	}
+	free(batch);
+}
+
+static void * replica_run(void * arg)
+{
+	replica * r = arg;
+	while(true)
+	{
+		pthread_mutex_lock(&(r->lock));
+		bool stopping = r->stopping;
+		pthread_mutex_unlock(&(r->lock));
+		if(stopping) return NULL;
+		replica_apply(r);
+		usleep(REPLICA_POLL_US);
+	}
+}
+
+bool db_replica_start(table * t, const char * log_path)
+{
+	int fd = open(log_path, O_RDONLY);
+	if(fd == -1) return false;
+	if(!log_header_valid(fd))
+	{
+		close(fd);
+		return false;
+	}
+	replica * r = malloc(sizeof(replica));
+	r->t = t;
+	r->log_path = strdup(log_path);
+	r->file_descriptor = fd;
+	r->stopping = false;
+	pthread_mutex_init(&(r->lock), NULL);
+	t->source = r;
+	pthread_create(&(r->thread), NULL, replica_run, r);
+	return true;
+}
+
+static void replica_stop(table * t)
+{
+	replica * r = t->source;
+	pthread_mutex_lock(&(r->lock));
+	r->stopping = true;
+	pthread_mutex_unlock(&(r->lock));
+	pthread_join(r->thread, NULL);
+	pthread_mutex_destroy(&(r->lock));
+	close(r->file_descriptor);
+	free(r->log_path);
+	free(r);
+	t->source = NULL;
+}
+
+void db_replica_pause(table * t)
+{
+	if(t->source) pthread_mutex_lock(&(t->source->lock));
+}
+
+void db_replica_resume(table * t)
+{
+	if(t->source) pthread_mutex_unlock(&(t->source->lock));
+}
+
+replicationRole db_replication_role(table * t)
+{
+	if(t->source) return REPLICATION_REPLICA;
+	return t->replication_log != -1 ? REPLICATION_PRIMARY : REPLICATION_NONE;
+}
+
+uint64_t db_lsn(table * t)
+{
+	// the replica thread advances the lsn of a replica
+	if(t->source == NULL) return t->lsn;
+	pthread_mutex_lock(&(t->source->lock));
+	uint64_t lsn = t->lsn;
+	pthread_mutex_unlock(&(t->source->lock));
+	return lsn;
+}
+
+void db_replica_status(table * t, replicaStatus * status)
+{
+	replica * r = t->source;
+	status->log_path = r->log_path;
+	pthread_mutex_lock(&(r->lock));
+	status->applied_lsn = t->lsn;
+	pthread_mutex_unlock(&(r->lock));
+	status->primary_lsn = log_num_records(r->file_descriptor);
+	status->lag_seconds = 0;
+	if(status->applied_lsn >= status->primary_lsn) return;
+	uint64_t written_ns;
+	off_t offset = LOG_HEADER_SIZE + status->applied_lsn * log_record_size() + LOG_RECORD_TIME_OFFSET;
+	if(pread(r->file_descriptor, &written_ns, sizeof(uint64_t), offset) != sizeof(uint64_t)) return;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	status->lag_seconds = ((double)now.tv_sec * 1e9 + now.tv_nsec - written_ns) / 1e9;
+}
@@ -0,0 +1,133 @@
+#ifndef DB_H
+#define DB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define COLUMN_USERNAME_SIZE 32
+#define COLUMN_EMAIL_SIZE 255 
+#define TABLE_MAX_PAGES 100 // pages are never evicted from the cache, so this also caps the size of a database
+#define MIN_PAGE_SIZE 4096
+#define MAX_PAGE_SIZE 65536
+#define DEFAULT_PAGE_SIZE 4096
+
+typedef struct 
+{
+	uint32_t id;
+	char username[COLUMN_USERNAME_SIZE+1];
+	char email[COLUMN_EMAIL_SIZE+1];
+}row;
+
+typedef enum
+{
+	EXECUTE_SUCCESS,
+	EXECUTE_DUPLICATE_KEY,
+	EXECUTE_TABLE_FULL,
+	EXECUTE_STRING_TOO_LONG,
+	EXECUTE_READ_ONLY,
+	EXECUTE_IO_ERROR
+}executeResult;
+
+typedef struct
+{
+	// what one statement did to the tree and the pager, collected only while a trace is set
+	uint32_t levels; // nodes visited while descending the tree
+	uint32_t hash_index_hits; // point lookups that skipped the descent
+	uint32_t page_hits;
+	uint32_t page_misses;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint32_t leaf_splits;
+	uint32_t internal_splits;
+}statementTrace;
+
+typedef struct table table;
+typedef struct tableCursor tableCursor;
+typedef struct backup backup;
+
+typedef enum
+{
+	EXPORT_COLUMNAR,
+	EXPORT_CSV
+}exportFormat;
+
+typedef enum
+{
+	REPLICATION_NONE,
+	REPLICATION_PRIMARY, // inserts are appended to a replication log
+	REPLICATION_REPLICA // the table follows a log and is read-only
+}replicationRole;
+
+typedef struct
+{
+	const char * log_path; // the log the replica follows
+	uint64_t applied_lsn;
+	uint64_t primary_lsn; // records in the log
+	double lag_seconds; // age of the oldest record not applied yet
+}replicaStatus;
+
+/*
+	rows are returned as pointers to their serialized form inside a cached page, they stay valid until
+	the next write to the table; use the db_row_* accessors or deserialize_row to read them.
+	cursors read a snapshot and may run on other threads while inserts go on, db_get reads the live tree
+	and belongs on the thread that writes.
+	once a read or write of the db file fails, db_error returns its errno, inserts fail, lookups and scans
+	end where the page is missing and db_close leaves the file as it was last closed
+*/
+table * db_open(const char * filename, uint32_t page_size); // NULL with errno set when the file cannot be opened
+table * db_open_compressed(const char * filename, uint32_t page_size); // a new file stores its pages compressed
+bool db_close(table * t); // false when the file was not written, the table is freed either way
+int db_error(table * t); // 0 while every read and write succeeded
+void db_warm_cache(table * t); // preload the pages cached at the last close and every internal node
+// buffered rows the full tree has no room for at a merge stay buffered, db_close does not write them
+void table_enable_memtable(table * t, uint32_t threshold);
+executeResult db_insert(table * t, uint32_t id, const char * username, const char * email);
+const void * db_get(table * t, uint32_t id); // ids looked up repeatedly skip the descent
+tableCursor * db_cursor_open(table * t);
+tableCursor * db_cursor_open_reverse(table * t);
+const void * db_cursor_row(tableCursor * tc); // NULL past the last row
+void db_cursor_next(tableCursor * tc);
+void db_cursor_close(tableCursor * tc);
+uint32_t db_row_id(const void * value);
+const char * db_row_username(const void * value);
+const char * db_row_email(const void * value);
+void deserialize_row(const void * src, row * dest);
+
+// count the page accesses, descents and splits of the calling thread into the trace until db_trace_end
+void db_trace_begin(table * t, statementTrace * trace);
+void db_trace_end(table * t);
+
+// write every row in id order to a new file, the columnar format keeps each column contiguous per row group
+bool db_export(table * t, const char * path, exportFormat format, uint64_t * num_rows);
+
+// online backup of a snapshot, streamed from a background thread
+bool backup_start(table * t, const char * path);
+bool backup_running(table * t); // started and not yet returned by backup_poll or backup_finish
+backup * backup_poll(table * t); // the finished backup, or NULL while it is running
+backup * backup_finish(table * t); // waits for the running backup, NULL when there is none
+const char * backup_path(backup * b);
+bool backup_failed(backup * b);
+uint32_t backup_pages_copied(backup * b);
+void backup_free(backup * b);
+
+/*
+	logical replication, the primary appends every insert to a log file and a replica applies it to its own
+	db file from a background thread
+*/
+bool db_enable_replication_log(table * t, const char * path);
+bool db_replica_start(table * t, const char * log_path); // the table becomes read-only
+replicationRole db_replication_role(table * t);
+uint64_t db_lsn(table * t); // log records written on a primary, applied on a replica
+/*
+	cursors read a snapshot of the replica while the log is applied, db_get and db_print_tree read the live tree
+	and go between db_replica_pause and db_replica_resume, which hold off the log and are a no-op on other tables
+*/
+void db_replica_pause(table * t);
+void db_replica_resume(table * t);
+void db_replica_status(table * t, replicaStatus * status); // only on a replica
+
+// debugging helpers
+void db_print_constants(table * t);
+void db_print_tree(table * t);
+
+#endif
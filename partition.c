@@ -0,0 +1,435 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "partition.h"
+
+#define SCAN_BATCH_ROWS 256
+#define NO_PARTITION UINT32_MAX
+
+// manifest layout
+static const uint32_t MANIFEST_MAGIC = 0x31504244; // "DBP1"
+static const uint32_t MANIFEST_MAGIC_OFFSET = 0;
+static const uint32_t MANIFEST_NUM_PARTITIONS_OFFSET = MANIFEST_MAGIC_OFFSET + sizeof(uint32_t);
+static const uint32_t MANIFEST_SCHEME_OFFSET = MANIFEST_NUM_PARTITIONS_OFFSET + sizeof(uint32_t);
+static const uint32_t MANIFEST_RANGE_WIDTH_OFFSET = MANIFEST_SCHEME_OFFSET + sizeof(uint32_t);
+static const uint32_t MANIFEST_SIZE = MANIFEST_RANGE_WIDTH_OFFSET + sizeof(uint32_t);
+
+typedef enum
+{
+	REQUEST_INSERT,
+	REQUEST_GET,
+	REQUEST_SCAN_OPEN,
+	REQUEST_SCAN_FETCH,
+	REQUEST_SCAN_CLOSE
+}requestType;
+
+typedef struct
+{
+	// the caller waits until every request it queued has run
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	uint32_t pending;
+}requestBatch;
+
+struct partitionRequest
+{
+	requestType type;
+	requestBatch * batch;
+	// insert, rows[i] reports into results[result_index[i]]
+	row * rows;
+	uint32_t * result_index;
+	uint32_t num_rows;
+	executeResult * results;
+	// get
+	uint32_t id;
+	row * dest;
+	bool found;
+	// scans
+	partitionScan * scan;
+	bool reverse;
+	partitionRequest * next;
+};
+
+static void batch_init(requestBatch * batch, uint32_t pending)
+{
+	pthread_mutex_init(&(batch->lock), NULL);
+	pthread_cond_init(&(batch->done), NULL);
+	batch->pending = pending;
+}
+
+static void batch_wait(requestBatch * batch)
+{
+	pthread_mutex_lock(&(batch->lock));
+	while(batch->pending > 0) pthread_cond_wait(&(batch->done), &(batch->lock));
+	pthread_mutex_unlock(&(batch->lock));
+	pthread_mutex_destroy(&(batch->lock));
+	pthread_cond_destroy(&(batch->done));
+}
+
+static void batch_complete(requestBatch * batch)
+{
+	pthread_mutex_lock(&(batch->lock));
+	batch->pending--;
+	if(batch->pending == 0) pthread_cond_signal(&(batch->done));
+	pthread_mutex_unlock(&(batch->lock));
+}
+
+static void scan_fill(partitionScan * scan)
+{
+	// copy the next batch of rows out of the pages, the merge reads them on the caller's thread
+	scan->num_rows = 0;
+	scan->next_row = 0;
+	while(scan->num_rows < SCAN_BATCH_ROWS)
+	{
+		const void * value = db_cursor_row(scan->tc);
+		if(value == NULL)
+		{
+			scan->exhausted = true;
+			break;
+		}
+		deserialize_row(value, &(scan->rows[scan->num_rows++]));
+		db_cursor_next(scan->tc);
+	}
+}
+
+static void run_request(table * t, partitionRequest * request)
+{
+	switch(request->type)
+	{
+		case (REQUEST_INSERT):
+			for(uint32_t i = 0; i<request->num_rows; i++)
+			{
+				row * r = &(request->rows[i]);
+				request->results[request->result_index[i]] = db_insert(t, r->id, r->username, r->email);
+			}
+			break;
+		case (REQUEST_GET):
+		{
+			const void * value = db_get(t, request->id);
+			request->found = value != NULL;
+			if(value) deserialize_row(value, request->dest);
+			break;
+		}
+		case (REQUEST_SCAN_OPEN):
+			request->scan->tc = request->reverse ? db_cursor_open_reverse(t) : db_cursor_open(t);
+			request->scan->exhausted = false;
+			scan_fill(request->scan);
+			break;
+		case (REQUEST_SCAN_FETCH):
+			scan_fill(request->scan);
+			break;
+		case (REQUEST_SCAN_CLOSE):
+			db_cursor_close(request->scan->tc);
+			break;
+	}
+}
+
+static void * partition_worker(void * arg)
+{
+	partition * part = arg;
+	while(true)
+	{
+		pthread_mutex_lock(&(part->lock));
+		while(part->head == NULL && !(part->stopping)) pthread_cond_wait(&(part->wake), &(part->lock));
+		partitionRequest * request = part->head;
+		if(request)
+		{
+			part->head = request->next;
+			if(part->head == NULL) part->tail = NULL;
+		}
+		pthread_mutex_unlock(&(part->lock));
+		if(request == NULL) return NULL; // stopping and nothing left to run
+		// the caller frees the request once its batch completes
+		run_request(part->t, request);
+		batch_complete(request->batch);
+	}
+}
+
+static void submit(partition * part, partitionRequest * request)
+{
+	request->next = NULL;
+	pthread_mutex_lock(&(part->lock));
+	if(part->tail) part->tail->next = request;
+	else part->head = request;
+	part->tail = request;
+	pthread_cond_signal(&(part->wake));
+	pthread_mutex_unlock(&(part->lock));
+}
+
+static bool partition_layout_valid(partitionedTable * pt)
+{
+	// partition_of divides by the range width and picks from num_partitions partitions
+	if(pt->num_partitions == 0) return false;
+	if(pt->scheme == PARTITION_BY_RANGE) return pt->range_width > 0;
+	return pt->scheme == PARTITION_BY_HASH;
+}
+
+static bool read_manifest(const char * filename, partitionedTable * pt)
+{
+	// false with errno ENOENT when there is no manifest yet
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1) return false;
+	uint8_t manifest[MANIFEST_SIZE];
+	ssize_t bytes_read = pread(fd, manifest, MANIFEST_SIZE, 0);
+	close(fd);
+	if(bytes_read != MANIFEST_SIZE || *(uint32_t *)(manifest + MANIFEST_MAGIC_OFFSET) != MANIFEST_MAGIC)
+	{
+		// not a partition manifest, a corrupt file
+		errno = EIO;
+		return false;
+	}
+	pt->num_partitions = *(uint32_t *)(manifest + MANIFEST_NUM_PARTITIONS_OFFSET);
+	pt->scheme = *(uint32_t *)(manifest + MANIFEST_SCHEME_OFFSET);
+	pt->range_width = *(uint32_t *)(manifest + MANIFEST_RANGE_WIDTH_OFFSET);
+	if(!partition_layout_valid(pt))
+	{
+		errno = EIO;
+		return false;
+	}
+	return true;
+}
+
+static bool write_manifest(const char * filename, partitionedTable * pt)
+{
+	uint8_t manifest[MANIFEST_SIZE];
+	*(uint32_t *)(manifest + MANIFEST_MAGIC_OFFSET) = MANIFEST_MAGIC;
+	*(uint32_t *)(manifest + MANIFEST_NUM_PARTITIONS_OFFSET) = pt->num_partitions;
+	*(uint32_t *)(manifest + MANIFEST_SCHEME_OFFSET) = pt->scheme;
+	*(uint32_t *)(manifest + MANIFEST_RANGE_WIDTH_OFFSET) = pt->range_width;
+	int fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, S_IWUSR|S_IRUSR);
+	if(fd == -1) return false;
+	bool written = pwrite(fd, manifest, MANIFEST_SIZE, 0) == MANIFEST_SIZE && fsync(fd) == 0;
+	int error = errno;
+	if(close(fd) == -1) written = false;
+	else errno = error;
+	return written;
+}
+
+partitionedTable * db_open_partitioned(const char * filename, uint32_t num_partitions, partitionScheme scheme, uint32_t range_width, uint32_t page_size)
+{
+	partitionedTable * pt = malloc(sizeof(partitionedTable));
+	if(!read_manifest(filename, pt))
+	{
+		// only a missing manifest is created, one that cannot be read is an error
+		pt->num_partitions = num_partitions;
+		pt->scheme = scheme;
+		pt->range_width = range_width;
+		if(errno == ENOENT && !partition_layout_valid(pt)) errno = EINVAL;
+		if(errno != ENOENT || !write_manifest(filename, pt))
+		{
+			free(pt);
+			return NULL;
+		}
+	}
+	pt->partitions = malloc(pt->num_partitions * sizeof(partition));
+	for(uint32_t i = 0; i<pt->num_partitions; i++)
+	{
+		partition * part = &(pt->partitions[i]);
+		char * path = malloc(strlen(filename) + 12);
+		sprintf(path, "%s.%u", filename, i);
+		part->t = db_open(path, page_size);
+		free(path);
+		if(part->t == NULL)
+		{
+			// close the partitions opened so far
+			int error = errno;
+			pt->num_partitions = i;
+			db_close_partitioned(pt);
+			errno = error;
+			return NULL;
+		}
+		pthread_mutex_init(&(part->lock), NULL);
+		pthread_cond_init(&(part->wake), NULL);
+		part->head = NULL;
+		part->tail = NULL;
+		part->stopping = false;
+		pthread_create(&(part->worker), NULL, partition_worker, part);
+	}
+	return pt;
+}
+
+bool db_close_partitioned(partitionedTable * pt)
+{
+	bool written = true;
+	for(uint32_t i = 0; i<pt->num_partitions; i++)
+	{
+		partition * part = &(pt->partitions[i]);
+		pthread_mutex_lock(&(part->lock));
+		part->stopping = true;
+		pthread_cond_signal(&(part->wake));
+		pthread_mutex_unlock(&(part->lock));
+	}
+	for(uint32_t i = 0; i<pt->num_partitions; i++)
+	{
+		partition * part = &(pt->partitions[i]);
+		pthread_join(part->worker, NULL);
+		if(!db_close(part->t)) written = false;
+		pthread_mutex_destroy(&(part->lock));
+		pthread_cond_destroy(&(part->wake));
+	}
+	free(pt->partitions);
+	free(pt);
+	return written;
+}
+
+uint32_t partition_of(partitionedTable * pt, uint32_t id)
+{
+	if(pt->scheme == PARTITION_BY_RANGE)
+	{
+		uint32_t index = id / pt->range_width;
+		return index < pt->num_partitions ? index : pt->num_partitions-1;
+	}
+	// multiplicative hash so runs of consecutive ids spread over every partition
+	uint32_t hash = id * 2654435761u;
+	return ((uint64_t)hash * pt->num_partitions) >> 32;
+}
+
+void db_partitioned_insert_rows(partitionedTable * pt, row * rows, uint32_t num_rows, executeResult * results)
+{
+	// one request per partition holding its share of the rows
+	partitionRequest * requests = calloc(pt->num_partitions, sizeof(partitionRequest));
+	for(uint32_t i = 0; i<num_rows; i++) requests[partition_of(pt, rows[i].id)].num_rows++;
+	uint32_t pending = 0;
+	for(uint32_t i = 0; i<pt->num_partitions; i++)
+	{
+		requests[i].type = REQUEST_INSERT;
+		requests[i].results = results;
+		requests[i].rows = malloc(requests[i].num_rows * sizeof(row));
+		requests[i].result_index = malloc(requests[i].num_rows * sizeof(uint32_t));
+		if(requests[i].num_rows > 0) pending++;
+		requests[i].num_rows = 0;
+	}
+	for(uint32_t i = 0; i<num_rows; i++)
+	{
+		partitionRequest * request = &(requests[partition_of(pt, rows[i].id)]);
+		memcpy(&(request->rows[request->num_rows]), &(rows[i]), sizeof(row));
+		request->result_index[request->num_rows++] = i;
+	}
+	requestBatch batch;
+	batch_init(&batch, pending);
+	for(uint32_t i = 0; i<pt->num_partitions; i++)
+	{
+		if(requests[i].num_rows == 0) continue;
+		requests[i].batch = &batch;
+		submit(&(pt->partitions[i]), &(requests[i]));
+	}
+	batch_wait(&batch);
+	for(uint32_t i = 0; i<pt->num_partitions; i++)
+	{
+		free(requests[i].rows);
+		free(requests[i].result_index);
+	}
+	free(requests);
+}
+
+executeResult db_partitioned_insert(partitionedTable * pt, uint32_t id, const char * username, const char * email)
+{
+	if(strlen(username) > COLUMN_USERNAME_SIZE || strlen(email) > COLUMN_EMAIL_SIZE) return EXECUTE_STRING_TOO_LONG;
+	row r;
+	r.id = id;
+	strcpy(r.username, username);
+	strcpy(r.email, email);
+	executeResult result;
+	db_partitioned_insert_rows(pt, &r, 1, &result);
+	return result;
+}
+
+bool db_partitioned_get(partitionedTable * pt, uint32_t id, row * dest)
+{
+	partitionRequest request;
+	requestBatch batch;
+	batch_init(&batch, 1);
+	request.type = REQUEST_GET;
+	request.batch = &batch;
+	request.id = id;
+	request.dest = dest;
+	submit(&(pt->partitions[partition_of(pt, id)]), &request);
+	batch_wait(&batch);
+	return request.found;
+}
+
+static void scan_request(partitionCursor * pc, requestType type, bool * selected)
+{
+	// run the request on the scans of the selected partitions, or all of them, in parallel
+	partitionRequest * requests = pc->requests;
+	uint32_t pending = 0;
+	for(uint32_t i = 0; i<pc->pt->num_partitions; i++) if(selected == NULL || selected[i]) pending++;
+	if(pending == 0) return;
+	requestBatch batch;
+	batch_init(&batch, pending);
+	for(uint32_t i = 0; i<pc->pt->num_partitions; i++)
+	{
+		if(selected && !selected[i]) continue;
+		requests[i].type = type;
+		requests[i].batch = &batch;
+		requests[i].scan = &(pc->scans[i]);
+		requests[i].reverse = pc->reverse;
+		submit(&(pc->pt->partitions[i]), &(requests[i]));
+	}
+	batch_wait(&batch);
+}
+
+partitionCursor * db_partitioned_cursor_open(partitionedTable * pt, bool reverse)
+{
+	partitionCursor * pc = malloc(sizeof(partitionCursor));
+	pc->pt = pt;
+	pc->reverse = reverse;
+	pc->current = NO_PARTITION;
+	pc->scans = malloc(pt->num_partitions * sizeof(partitionScan));
+	for(uint32_t i = 0; i<pt->num_partitions; i++) pc->scans[i].rows = malloc(SCAN_BATCH_ROWS * sizeof(row));
+	pc->requests = malloc(pt->num_partitions * sizeof(partitionRequest));
+	pc->refill = malloc(pt->num_partitions * sizeof(bool));
+	scan_request(pc, REQUEST_SCAN_OPEN, NULL);
+	return pc;
+}
+
+const row * db_partitioned_cursor_row(partitionCursor * pc)
+{
+	// refill every scan that ran out of rows before comparing the heads of the partitions
+	uint32_t num_partitions = pc->pt->num_partitions;
+	bool any_refill = false;
+	for(uint32_t i = 0; i<num_partitions; i++)
+	{
+		partitionScan * scan = &(pc->scans[i]);
+		pc->refill[i] = scan->next_row == scan->num_rows && !(scan->exhausted);
+		if(pc->refill[i]) any_refill = true;
+	}
+	if(any_refill) scan_request(pc, REQUEST_SCAN_FETCH, pc->refill);
+	pc->current = NO_PARTITION;
+	const row * best = NULL;
+	for(uint32_t i = 0; i<num_partitions; i++)
+	{
+		partitionScan * scan = &(pc->scans[i]);
+		if(scan->next_row == scan->num_rows) continue;
+		const row * head = &(scan->rows[scan->next_row]);
+		if(best == NULL || (pc->reverse ? head->id > best->id : head->id < best->id))
+		{
+			best = head;
+			pc->current = i;
+		}
+	}
+	return best;
+}
+
+void db_partitioned_cursor_next(partitionCursor * pc)
+{
+	if(pc->current == NO_PARTITION && db_partitioned_cursor_row(pc) == NULL) return;
+	pc->scans[pc->current].next_row++;
+	pc->current = NO_PARTITION;
+}
+
+void db_partitioned_cursor_close(partitionCursor * pc)
+{
+	scan_request(pc, REQUEST_SCAN_CLOSE, NULL);
+	for(uint32_t i = 0; i<pc->pt->num_partitions; i++) free(pc->scans[i].rows);
+	free(pc->scans);
+	free(pc->requests);
+	free(pc->refill);
+	free(pc);
+}
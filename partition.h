@@ -0,0 +1,76 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "db.h"
+
+typedef enum
+{
+	PARTITION_BY_HASH,
+	PARTITION_BY_RANGE
+}partitionScheme;
+
+typedef struct partitionRequest partitionRequest;
+
+typedef struct
+{
+	// one db file, only its worker thread touches the table while the partitioned table is open
+	table * t;
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	partitionRequest * head;
+	partitionRequest * tail;
+	bool stopping;
+}partition;
+
+typedef struct
+{
+	uint32_t num_partitions;
+	partitionScheme scheme;
+	uint32_t range_width; // ids [i*width, (i+1)*width) go to partition i, the last one takes the rest
+	partition * partitions;
+}partitionedTable;
+
+typedef struct
+{
+	// rows fetched from one partition in a batch by its worker
+	tableCursor * tc;
+	row * rows;
+	uint32_t num_rows;
+	uint32_t next_row;
+	bool exhausted;
+}partitionScan;
+
+typedef struct
+{
+	// merges the scans of every partition in id order
+	partitionedTable * pt;
+	bool reverse;
+	partitionScan * scans;
+	uint32_t current; // partition of the row returned last
+	// one slot per partition, reused by every refill
+	partitionRequest * requests;
+	bool * refill;
+}partitionCursor;
+
+/*
+	the partition layout is kept in a small manifest at filename, partition i is the db file filename.i;
+	the number of partitions, scheme, range width and page size only apply when the manifest is created;
+	NULL with errno set when the manifest or a partition cannot be opened
+*/
+partitionedTable * db_open_partitioned(const char * filename, uint32_t num_partitions, partitionScheme scheme, uint32_t range_width, uint32_t page_size);
+bool db_close_partitioned(partitionedTable * pt); // false when a partition was not written
+uint32_t partition_of(partitionedTable * pt, uint32_t id);
+executeResult db_partitioned_insert(partitionedTable * pt, uint32_t id, const char * username, const char * email);
+// inserts run on the workers of their partitions in parallel, results[i] is the result of rows[i]
+void db_partitioned_insert_rows(partitionedTable * pt, row * rows, uint32_t num_rows, executeResult * results);
+bool db_partitioned_get(partitionedTable * pt, uint32_t id, row * dest);
+partitionCursor * db_partitioned_cursor_open(partitionedTable * pt, bool reverse);
+const row * db_partitioned_cursor_row(partitionCursor * pc); // NULL past the last row
+void db_partitioned_cursor_next(partitionCursor * pc);
+void db_partitioned_cursor_close(partitionCursor * pc);
+
+#endif
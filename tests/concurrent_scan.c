@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../db.h"
+
+/*
+	regression check for snapshot isolation: one thread scans the table with cursors in a loop while
+	another inserts random ids, every scan must return distinct ids in order with the row contents they
+	were inserted with, and never fewer rows than the scan before it
+
+	gcc tests/concurrent_scan.c db.c -o concurrent_scan -pthread && ./concurrent_scan
+*/
+
+#define NUM_ROWS 5000
+#define PAGE_SIZE 65536
+
+typedef struct
+{
+	table * t;
+	bool done;
+	pthread_mutex_t lock;
+}ingest;
+
+void * insert_rows(void * arg)
+{
+	ingest * in = arg;
+	uint32_t * ids = malloc(NUM_ROWS * sizeof(uint32_t));
+	for(uint32_t i = 0; i<NUM_ROWS; i++) ids[i] = i+1;
+	for(uint32_t i = NUM_ROWS-1; i>0; i--)
+	{
+		uint32_t j = rand() % (i+1), id = ids[i];
+		ids[i] = ids[j];
+		ids[j] = id;
+	}
+	for(uint32_t i = 0; i<NUM_ROWS; i++)
+	{
+		char username[COLUMN_USERNAME_SIZE+1], email[COLUMN_EMAIL_SIZE+1];
+		sprintf(username, "u%u", ids[i]);
+		sprintf(email, "e%u@example.com", ids[i]);
+		if(db_insert(in->t, ids[i], username, email) != EXECUTE_SUCCESS)
+		{
+			printf("Insert of %u failed.\n", ids[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	free(ids);
+	pthread_mutex_lock(&(in->lock));
+	in->done = true;
+	pthread_mutex_unlock(&(in->lock));
+	return NULL;
+}
+
+bool scan(table * t, bool reverse, uint32_t * num_rows)
+{
+	// true when the rows came back in order and intact
+	tableCursor * tc = reverse ? db_cursor_open_reverse(t) : db_cursor_open(t);
+	bool ok = true;
+	uint32_t count = 0, last_id = 0;
+	for(const void * value = db_cursor_row(tc); value; db_cursor_next(tc), value = db_cursor_row(tc))
+	{
+		uint32_t id = db_row_id(value);
+		char username[COLUMN_USERNAME_SIZE+1];
+		sprintf(username, "u%u", id);
+		if(count > 0 && (reverse ? id >= last_id : id <= last_id)) ok = false;
+		if(strcmp(db_row_username(value), username) != 0) ok = false;
+		last_id = id;
+		count++;
+	}
+	db_cursor_close(tc);
+	*num_rows = count;
+	return ok;
+}
+
+bool run(uint32_t memtable_threshold)
+{
+	char path[] = "/tmp/concurrent_scanXXXXXX";
+	int fd = mkstemp(path);
+	close(fd);
+	unlink(path);
+	ingest in;
+	in.t = db_open(path, PAGE_SIZE);
+	in.done = false;
+	pthread_mutex_init(&(in.lock), NULL);
+	if(memtable_threshold > 0) table_enable_memtable(in.t, memtable_threshold);
+	pthread_t writer;
+	pthread_create(&writer, NULL, insert_rows, &in);
+	uint32_t scans = 0, failures = 0, last_count = 0;
+	while(true)
+	{
+		pthread_mutex_lock(&(in.lock));
+		bool done = in.done;
+		pthread_mutex_unlock(&(in.lock));
+		uint32_t count;
+		if(!scan(in.t, scans % 2 == 1, &count) || count < last_count) failures++;
+		last_count = count;
+		scans++;
+		if(done) break;
+	}
+	pthread_join(writer, NULL);
+	if(last_count != NUM_ROWS) failures++;
+	printf("memtable %u: %u scans, %u failed\n", memtable_threshold, scans, failures);
+	db_close(in.t);
+	pthread_mutex_destroy(&(in.lock));
+	unlink(path);
+	return failures == 0;
+}
+
+int main()
+{
+	srand(1);
+	bool ok = run(0);
+	ok = run(64) && ok;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}